@@ -0,0 +1,74 @@
+/* jodyhash utility: simple bump allocator
+ *
+ * Many small allocations that all live until the same moment (lines,
+ * keys, path names) are carved out of large chunks and released all at
+ * once. There is no per-allocation free.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	uint64_t data[];
+};
+
+#define ARENA_ALIGN 8U
+
+
+extern void arena_init(struct arena *a)
+{
+	a->head = NULL;
+	a->used = 0;
+	a->size = 0;
+	a->total = 0;
+	return;
+}
+
+
+/* Returns ARENA_ALIGN-aligned memory or NULL when out of memory */
+extern void *arena_alloc(struct arena *a, size_t len)
+{
+	struct arena_chunk *chunk;
+	size_t size;
+	void *p;
+
+	len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (a->head == NULL || a->size - a->used < len) {
+		size = (len > ARENA_CHUNK) ? len : ARENA_CHUNK;
+		chunk = (struct arena_chunk *)malloc(sizeof(struct arena_chunk) + size);
+		if (chunk == NULL) return NULL;
+		/* An oversized chunk goes behind the current one so its free space isn't lost */
+		if (size > ARENA_CHUNK && a->head != NULL) {
+			chunk->next = a->head->next;
+			a->head->next = chunk;
+			a->total += len;
+			return chunk->data;
+		}
+		chunk->next = a->head;
+		a->head = chunk;
+		a->used = 0;
+		a->size = size;
+	}
+	p = (char *)a->head->data + a->used;
+	a->used += len;
+	a->total += len;
+	return p;
+}
+
+
+extern void arena_free(struct arena *a)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = a->head; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena_init(a);
+	return;
+}
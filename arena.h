@@ -0,0 +1,33 @@
+/* jodyhash utility: simple bump allocator (headers)
+ * See utility.c for license information */
+
+#ifndef JH_ARENA_H
+#define JH_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Default chunk size; larger requests get a chunk of their own */
+#define ARENA_CHUNK (1024 * 1024)
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *head;
+	size_t used;
+	size_t size;
+	size_t total;  /* Bytes handed out (for statistics) */
+};
+
+extern void arena_init(struct arena *a);
+extern void *arena_alloc(struct arena *a, size_t len);
+extern void arena_free(struct arena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_ARENA_H */
@@ -1,46 +1,427 @@
+/* jodyhash benchmark suite
+ *
+ * Measures bulk throughput over a sweep of sizes and alignment offsets,
+ * short-key latency percentiles, and end-to-end file hashing for every
+ * code path (scalar/SSE2/AVX2) this build and CPU support. The hash
+ * width is fixed at build time; 'make benchmark' builds one program per
+ * width. Results can be printed as JSON lines and compared against a
+ * saved baseline so kernel performance regressions are caught.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <sys/time.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "jody_hash.h"
 
-#define BLOCKSIZE 32768
+#define FILE_BSIZE 32768
+#define LATENCY_SAMPLES 20001
+#define LATENCY_BATCH 8
+#define MAX_BASELINE 4096
+#define FIELD_MAX 64
 
-int main(int argc, char **argv)
+static const int backends[] = { JODY_HASH_SCALAR, JODY_HASH_SSE2, JODY_HASH_AVX2 };
+static const size_t offsets[] = { 0, 1, 8, 16, 24 };
+static const size_t latency_sizes[] = { 1, 4, 8, 12, 16, 24, 32, 48, 64, 96, 128 };
+
+static int json = 0;
+static double min_time = 0.05;
+static uint64_t max_size = (uint64_t)256 << 20;
+static uint64_t file_size = (uint64_t)64 << 20;
+static const char *exec_path = NULL;
+static double tolerance = 10.0;
+static char *baseline[MAX_BASELINE];
+static int baseline_count = 0;
+static int regressions = 0;
+static volatile jodyhash_t sink;
+
+
+static double now(void)
 {
-	static struct timeval starttime, endtime;
-	static long long elapsed;
-	static jodyhash_t hash = 0;
-	static unsigned long long iterations, cnt;
-	static jodyhash_t block[BLOCKSIZE / sizeof(jodyhash_t)];
+	struct timespec ts;
 
-	if (argc != 2) {
-		fprintf(stderr, "Specify number of iterations to run\n");
-		exit(EXIT_FAILURE);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [options]\n", progname);
+	fprintf(stderr, "  -j         JSON lines output\n");
+	fprintf(stderr, "  -q         quick run (shorter timings, sizes up to 1 MiB)\n");
+	fprintf(stderr, "  -m SIZE    largest bulk size in bytes (default 268435456)\n");
+	fprintf(stderr, "  -f SIZE    file-mode test size in bytes, 0 to skip (default 67108864)\n");
+	fprintf(stderr, "  -x PROG    also time PROG (e.g. ./jodyhash) on the test file\n");
+	fprintf(stderr, "  -c FILE    compare against a saved -j baseline; exit 1 on regressions\n");
+	fprintf(stderr, "  -t PCT     allowed slowdown for -c in percent (default 10)\n");
+	return;
+}
+
+
+/* Pull one field out of a JSON line written by this program */
+static int json_field(const char *line, const char *key, char *out)
+{
+	char pattern[FIELD_MAX + 4];
+	const char *p;
+	size_t len = 0;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	p = strstr(line, pattern);
+	if (p == NULL) return 1;
+	p += strlen(pattern);
+	if (*p == '"') p++;
+	while (p[len] != '\0' && p[len] != '"' && p[len] != ',' && p[len] != '}' && len < FIELD_MAX - 1) len++;
+	memcpy(out, p, len);
+	out[len] = '\0';
+	return 0;
+}
+
+
+static int load_baseline(const char *path)
+{
+	char line[1024];
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) return 1;
+	while (fgets(line, sizeof(line), fp) != NULL && baseline_count < MAX_BASELINE) {
+		baseline[baseline_count] = strdup(line);
+		if (baseline[baseline_count] == NULL) break;
+		baseline_count++;
 	}
+	fclose(fp);
+	return 0;
+}
 
-	iterations = atoi(argv[1]);
 
-	if (iterations < 1) {
-		fprintf(stderr, "Iteration count must be a positive integer\n");
+/* Compare a result against the baseline entry with the same key fields.
+ * 'higher_better' tells which direction counts as a regression. */
+static void compare(const char *test, const char *backend, uint64_t size, size_t offset,
+		const char *metric, double value, int higher_better)
+{
+	char field[FIELD_MAX], want[FIELD_MAX];
+	double base, change;
+
+	for (int i = 0; i < baseline_count; i++) {
+		if (json_field(baseline[i], "test", field) || strcmp(field, test)) continue;
+		if (json_field(baseline[i], "backend", field) || strcmp(field, backend)) continue;
+		snprintf(want, sizeof(want), "%d", JODY_HASH_WIDTH);
+		if (json_field(baseline[i], "width", field) || strcmp(field, want)) continue;
+		snprintf(want, sizeof(want), "%llu", (unsigned long long)size);
+		if (json_field(baseline[i], "size", field) || strcmp(field, want)) continue;
+		snprintf(want, sizeof(want), "%zu", offset);
+		if (json_field(baseline[i], "offset", field) || strcmp(field, want)) continue;
+		if (json_field(baseline[i], metric, field)) continue;
+
+		base = strtod(field, NULL);
+		if (base <= 0.0) return;
+		change = (value - base) * 100.0 / base;
+		if (!higher_better) change = -change;
+		if (change < -tolerance) {
+			fprintf(stderr, "REGRESSION: %s %s width %d size %llu offset %zu: %s %.2f -> %.2f (%+.1f%%)\n",
+					test, backend, JODY_HASH_WIDTH, (unsigned long long)size, offset,
+					metric, base, value, change);
+			regressions++;
+		}
+		return;
+	}
+	return;
+}
+
+
+/* Time 'iters' hashes of 'size' bytes at 'data' */
+static double time_bulk(jodyhash_t *data, size_t size, uint64_t iters)
+{
+	jodyhash_t hash = 0;
+	double start = now();
+
+	for (uint64_t i = 0; i < iters; i++) jody_block_hash(data, &hash, size);
+	sink = hash;
+	return now() - start;
+}
+
+
+/* Best-of-three throughput for one size and alignment offset */
+static void bench_bulk(const char *backend, unsigned char *buf, size_t size, size_t offset)
+{
+	jodyhash_t *data = (jodyhash_t *)(void *)(buf + offset);
+	uint64_t iters = 1;
+	double elapsed, best;
+
+	/* Find an iteration count that runs for at least min_time */
+	while ((elapsed = time_bulk(data, size, iters)) < min_time) {
+		if (elapsed <= 0.0) iters *= 16;
+		else iters = (uint64_t)((double)iters * (min_time * 1.2 / elapsed)) + 1;
+	}
+	best = elapsed;
+	for (int t = 0; t < 2; t++) {
+		elapsed = time_bulk(data, size, iters);
+		if (elapsed < best) best = elapsed;
+	}
+
+	double ns = best * 1e9 / (double)iters;
+	double mbs = (double)size * (double)iters / best / 1048576.0;
+
+	if (json) printf("{\"test\":\"bulk\",\"width\":%d,\"backend\":\"%s\",\"size\":%zu,\"offset\":%zu,"
+			"\"ns_per_call\":%.3f,\"mb_per_sec\":%.2f}\n",
+			JODY_HASH_WIDTH, backend, size, offset, ns, mbs);
+	else printf("bulk     %-6s %10zu bytes  +%-2zu  %12.2f ns/call  %10.2f MiB/s\n",
+			backend, size, offset, ns, mbs);
+	compare("bulk", backend, size, offset, "mb_per_sec", mbs, 1);
+	return;
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* Per-call latency percentiles for a short key. Calls are timed in
+ * small batches to stay above clock resolution, and the cost of reading
+ * the clock is subtracted. */
+static void bench_latency(const char *backend, unsigned char *buf, size_t size, double overhead)
+{
+	static double samples[LATENCY_SAMPLES];
+	jodyhash_t *data = (jodyhash_t *)(void *)buf;
+	const int n = LATENCY_SAMPLES;
+	double start, p50, p90, p99, p999;
+
+	for (int i = 0; i < n; i++) {
+		start = now();
+		for (int b = 0; b < LATENCY_BATCH; b++) {
+			jodyhash_t hash = 0;
+
+			jody_block_hash(data, &hash, size);
+			sink = hash;
+		}
+		samples[i] = (now() - start - overhead) * 1e9 / LATENCY_BATCH;
+		if (samples[i] < 0.0) samples[i] = 0.0;
+	}
+	qsort(samples, (size_t)n, sizeof(double), cmp_double);
+	p50 = samples[n / 2];
+	p90 = samples[(n * 90) / 100];
+	p99 = samples[(n * 99) / 100];
+	p999 = samples[(n * 999) / 1000];
+
+	if (json) printf("{\"test\":\"latency\",\"width\":%d,\"backend\":\"%s\",\"size\":%zu,\"offset\":0,"
+			"\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"p999_ns\":%.2f}\n",
+			JODY_HASH_WIDTH, backend, size, p50, p90, p99, p999);
+	else printf("latency  %-6s %10zu bytes       p50 %7.2f  p90 %7.2f  p99 %7.2f  p99.9 %7.2f ns\n",
+			backend, size, p50, p90, p99, p999);
+	compare("latency", backend, size, 0, "p50_ns", p50, 0);
+	return;
+}
+
+
+static double timer_overhead(void)
+{
+	double best = 1.0, start, elapsed;
+
+	for (int i = 0; i < 1000; i++) {
+		start = now();
+		elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	return best;
+}
+
+
+/* Read and hash a file the same way the jodyhash utility does */
+static double hash_file(const char *path)
+{
+	static jodyhash_t blk[FILE_BSIZE / sizeof(jodyhash_t)];
+	jodyhash_t hash = 0;
+	size_t i;
+	double start = now();
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) return -1.0;
+	while ((i = fread(blk, 1, FILE_BSIZE, fp)) > 0) jody_block_hash(blk, &hash, i);
+	fclose(fp);
+	sink = hash;
+	return now() - start;
+}
+
+
+/* Time an external program hashing the file, including process startup */
+static double exec_file(const char *path)
+{
+	double start;
+	int status;
+	pid_t pid;
+
+	/* Don't let the child inherit and flush our pending output */
+	fflush(stdout);
+	start = now();
+	pid = fork();
+
+	if (pid < 0) return -1.0;
+	if (pid == 0) {
+		if (freopen("/dev/null", "w", stdout) == NULL) _exit(127);
+		execl(exec_path, exec_path, path, (char *)NULL);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1.0;
+	return now() - start;
+}
+
+
+static void report_file(const char *test, const char *backend, double best)
+{
+	double mbs = (double)file_size / best / 1048576.0;
+
+	if (json) printf("{\"test\":\"%s\",\"width\":%d,\"backend\":\"%s\",\"size\":%llu,\"offset\":0,"
+			"\"seconds\":%.6f,\"mb_per_sec\":%.2f}\n",
+			test, JODY_HASH_WIDTH, backend, (unsigned long long)file_size, best, mbs);
+	else printf("%-8s %-6s %10llu bytes       %12.6f s        %10.2f MiB/s\n",
+			test, backend, (unsigned long long)file_size, best, mbs);
+	compare(test, backend, file_size, 0, "mb_per_sec", mbs, 1);
+	return;
+}
+
+
+/* Write a test file of random data; the page cache keeps it warm */
+static int make_test_file(char *path, const unsigned char *buf, size_t buflen)
+{
+	uint64_t left = file_size;
+	int fd = mkstemp(path);
+	FILE *fp;
+
+	if (fd < 0) return 1;
+	fp = fdopen(fd, "wb");
+	if (fp == NULL) return 1;
+	while (left > 0) {
+		size_t chunk = (left > buflen) ? buflen : (size_t)left;
+
+		if (fwrite(buf, 1, chunk, fp) != chunk) {
+			fclose(fp);
+			return 1;
+		}
+		left -= chunk;
+	}
+	if (fclose(fp) != 0) return 1;
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned char *mem, *buf;
+	size_t buflen;
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	char tmpname[] = "/tmp/jodyhash_bench.XXXXXX";
+	int opt, have_file = 0;
+	double overhead;
+
+	while ((opt = getopt(argc, argv, "jqm:f:x:c:t:h")) != -1) {
+		switch (opt) {
+			case 'j': json = 1; break;
+			case 'q':
+				min_time = 0.01;
+				max_size = (uint64_t)1 << 20;
+				file_size = (uint64_t)16 << 20;
+				break;
+			case 'm': max_size = strtoull(optarg, NULL, 10); break;
+			case 'f': file_size = strtoull(optarg, NULL, 10); break;
+			case 'x': exec_path = optarg; break;
+			case 'c':
+				if (load_baseline(optarg) != 0) {
+					fprintf(stderr, "cannot read baseline: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 't': tolerance = strtod(optarg, NULL); break;
+			case 'h':
+				usage(argv[0]);
+				exit(EXIT_SUCCESS);
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (max_size < 1) {
+		fprintf(stderr, "maximum size must be at least 1 byte\n");
 		exit(EXIT_FAILURE);
 	}
 
-	gettimeofday(&starttime, NULL);
-	for (cnt = iterations; cnt; cnt--) hash = jody_block_hash((jodyhash_t *)&block, hash, BLOCKSIZE);
-	gettimeofday(&endtime, NULL);
-	elapsed = endtime.tv_sec - starttime.tv_sec;
-	elapsed *= 1000000;
-	elapsed += (endtime.tv_usec - starttime.tv_usec);
-	if (elapsed < 1) {
-		fprintf(stderr, "Elapsed time invalid, aborting\n");
+	/* One 64-byte aligned buffer serves every test; offsets index into it */
+	buflen = (size_t)max_size;
+	if (buflen < FILE_BSIZE) buflen = FILE_BSIZE;
+	mem = (unsigned char *)malloc(buflen + 128);
+	if (mem == NULL) {
+		fprintf(stderr, "out of memory\n");
 		exit(EXIT_FAILURE);
 	}
+	buf = (unsigned char *)(((uintptr_t)mem + 63) & ~(uintptr_t)63);
+	for (size_t i = 0; i < buflen + 64; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		buf[i] = (unsigned char)x;
+	}
+
+	if (file_size > 0) {
+		if (make_test_file(tmpname, buf, buflen) != 0) fprintf(stderr, "cannot create test file; skipping file tests\n");
+		else have_file = 1;
+	}
+	overhead = timer_overhead();
 
-	printf("%llu blocks in %lld uSec (%llu blocks per second, %llu MB/sec overall)\n", iterations, elapsed,
-			(unsigned long long)((iterations * 1000000) / elapsed),
-			(unsigned long long)((iterations * 1000000) / elapsed) * BLOCKSIZE / 1048576
-			);
+	for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+		const char *name;
+
+		if (jody_hash_set_backend(backends[b]) != 0) continue;
+		name = jody_hash_backend_name();
+
+		/* Bulk: powers of two plus their odd neighbors to exercise tails */
+		for (uint64_t size = 1; size <= max_size; size *= 2) {
+			for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+				bench_bulk(name, buf, (size_t)size, offsets[o]);
+			if (size >= 4 && size < max_size) bench_bulk(name, buf, (size_t)size + 3, 0);
+		}
+
+		for (size_t s = 0; s < sizeof(latency_sizes) / sizeof(latency_sizes[0]); s++)
+			bench_latency(name, buf, latency_sizes[s], overhead);
+
+		if (have_file) {
+			double best = -1.0, t;
+
+			/* First pass warms the page cache */
+			for (int r = 0; r < 4; r++) {
+				t = hash_file(tmpname);
+				if (r > 0 && t > 0.0 && (best < 0.0 || t < best)) best = t;
+			}
+			if (best > 0.0) report_file("file", name, best);
+		}
+	}
+	jody_hash_set_backend(JODY_HASH_AUTO);
+
+	if (have_file && exec_path != NULL) {
+		double best = -1.0, t;
+
+		for (int r = 0; r < 3; r++) {
+			t = exec_file(tmpname);
+			if (t > 0.0 && (best < 0.0 || t < best)) best = t;
+		}
+		if (best > 0.0) report_file("exec", "auto", best);
+		else fprintf(stderr, "cannot run %s\n", exec_path);
+	}
+
+	if (have_file) unlink(tmpname);
+	free(mem);
+	for (int i = 0; i < baseline_count; i++) free(baseline[i]);
+
+	if (regressions > 0) {
+		fprintf(stderr, "%d performance regression(s) beyond %.1f%%\n", regressions, tolerance);
+		exit(EXIT_FAILURE);
+	}
 	exit(EXIT_SUCCESS);
 }
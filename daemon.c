@@ -0,0 +1,815 @@
+/* jodyhash utility: local hashing daemon and client
+ *
+ * The daemon listens on a UNIX socket and hashes files for any number of
+ * clients with one pool of worker threads, so short-lived callers share
+ * a warm process, page cache and result cache instead of each starting
+ * their own. Results for regular files are cached by device, inode, size,
+ * mtime and ctime, so a changed file never matches a stale entry; passed
+ * descriptors are hashed from their current offset, which is part of
+ * the key too.
+ *
+ * Protocol: newline-terminated requests "ID PATH" (absolute path) or
+ * "ID -" with a descriptor passed alongside (SCM_RIGHTS) whose data is
+ * hashed. Replies "ID HASH" or "ID error MESSAGE" are sent as each job
+ * finishes, so they may arrive in any order. IDs are chosen by clients.
+ *
+ * The socket is created accessible to its owner only: the daemon can
+ * read whatever its own user can.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "daemon.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hashfile.h"
+#include "hashutil.h"
+#include "hashset.h"
+
+#define DAEMON_BSIZE (128 * 1024)
+/* Longest request line */
+#define CONN_INBUF (PATH_MAX + 64)
+/* Passed descriptors held per connection until "ID -" requests use them */
+#define CONN_MAXFDS 64
+#define CACHE_MAX (1024 * 1024)
+
+#if JODY_HASH_WIDTH == 64
+#define HASH_FMT "%016" PRIx64
+#endif
+#if JODY_HASH_WIDTH == 32
+#define HASH_FMT "%08" PRIx32
+#endif
+#if JODY_HASH_WIDTH == 16
+#define HASH_FMT "%04" PRIx16
+#endif
+
+struct conn {
+	int fd;
+	int closed;          /* Freed once no jobs refer to it */
+	unsigned int pending;
+	char in[CONN_INBUF];
+	size_t inlen;
+	int fds[CONN_MAXFDS];
+	int nfds;
+	/* Replies waiting to be sent; guarded by lock */
+	char *out;
+	size_t outlen;
+	size_t outsize;
+	struct conn *next;
+};
+
+struct job {
+	struct conn *c;
+	unsigned long long id;
+	int fd;              /* Passed descriptor, or -1 to open path */
+	struct job *next;
+	char path[];
+};
+
+struct cache_key {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	int64_t ctime;
+	uint64_t offset;  /* Where a passed descriptor's data starts */
+};
+
+/* lock guards the job queue, connection reply buffers and counters */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static struct job *queue_head = NULL, *queue_tail = NULL;
+static int stopping = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hashset cache;
+/* Workers poke this pipe so the main loop sends new replies */
+static int wake_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t got_signal = 0;
+
+
+/* The wake pipe makes poll() return even if the signal arrives just
+ * before the main loop goes to sleep */
+static void on_signal(int sig)
+{
+	int saved = errno;
+
+	(void)sig;
+	got_signal = 1;
+	if (wake_pipe[1] >= 0 && write(wake_pipe[1], "", 1) < 0) {
+		/* Full pipe: the main loop will wake up anyway */
+	}
+	errno = saved;
+	return;
+}
+
+
+/* Tell the main loop there are replies to send */
+static void wake_main(void)
+{
+	struct pollfd pfd;
+
+	while (write(wake_pipe[1], "", 1) < 0) {
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN) {
+			fprintf(stderr, "error: cannot wake main loop: %s\n", strerror(errno));
+			return;
+		}
+		/* Wait for the main loop to drain the pipe, then try again */
+		pfd.fd = wake_pipe[1];
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, -1);
+	}
+	return;
+}
+
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) return 1;
+	return 0;
+}
+
+
+/* Queue a reply; call with lock held */
+static int conn_reply(struct conn *c, const char *reply)
+{
+	size_t len = strlen(reply);
+
+	if (c->closed) return 0;
+	if (c->outlen + len > c->outsize) {
+		size_t newsize = c->outsize ? c->outsize * 2 : 4096;
+		char *newout;
+
+		while (c->outlen + len > newsize) newsize *= 2;
+		newout = (char *)realloc(c->out, newsize);
+		if (newout == NULL) return 1;
+		c->out = newout;
+		c->outsize = newsize;
+	}
+	memcpy(c->out + c->outlen, reply, len);
+	c->outlen += len;
+	return 0;
+}
+
+
+/* Hash one job into reply */
+static void run_job(struct job *j, struct hashfile *hf, jodyhash_t *buf, char *reply, size_t size)
+{
+	struct cache_key key;
+	struct stat st;
+	jodyhash_t *cached;
+	FILE *fp;
+	int fd = j->fd, cacheable;
+
+	if (fd < 0) {
+		fd = open(j->path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			snprintf(reply, size, "%llu error cannot open: %s\n", j->id, strerror(errno));
+			return;
+		}
+	}
+	if (fstat(fd, &st) != 0) {
+		snprintf(reply, size, "%llu error cannot stat: %s\n", j->id, strerror(errno));
+		close(fd);
+		return;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		snprintf(reply, size, "%llu error is a directory\n", j->id);
+		close(fd);
+		return;
+	}
+
+	cacheable = S_ISREG(st.st_mode);
+	if (cacheable) {
+		memset(&key, 0, sizeof(key));
+		key.dev = (uint64_t)st.st_dev;
+		key.ino = (uint64_t)st.st_ino;
+		key.size = (uint64_t)st.st_size;
+		key.mtime = ST_NSEC(st, m);
+		key.ctime = ST_NSEC(st, c);
+		if (j->fd >= 0) {
+			off_t pos = lseek(fd, 0, SEEK_CUR);
+
+			if (pos < 0) {
+				snprintf(reply, size, "%llu error cannot seek: %s\n", j->id, strerror(errno));
+				close(fd);
+				return;
+			}
+			key.offset = (uint64_t)pos;
+		}
+		pthread_mutex_lock(&cache_lock);
+		/* A failed re-init below leaves the cache turned off */
+		cached = (cache.slots != NULL) ? (jodyhash_t *)hashset_find(&cache, &key, sizeof(key)) : NULL;
+		if (cached != NULL) {
+			snprintf(reply, size, "%llu " HASH_FMT "\n", j->id, *cached);
+			pthread_mutex_unlock(&cache_lock);
+			close(fd);
+			return;
+		}
+		pthread_mutex_unlock(&cache_lock);
+	}
+
+	fp = fdopen(fd, "rb");
+	if (fp == NULL) {
+		snprintf(reply, size, "%llu error out of memory\n", j->id);
+		close(fd);
+		return;
+	}
+	hashfile_reset(hf);
+	if (hashfile_read(hf, fp, buf, DAEMON_BSIZE) != HF_OK) {
+		snprintf(reply, size, "%llu error reading file\n", j->id);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+	snprintf(reply, size, "%llu " HASH_FMT "\n", j->id, hf->hash);
+
+	if (cacheable) {
+		int inserted;
+
+		pthread_mutex_lock(&cache_lock);
+		/* Start over rather than grow without bound */
+		if (cache.count >= CACHE_MAX) {
+			hashset_free(&cache);
+			hashset_init(&cache, sizeof(jodyhash_t));
+		}
+		if (cache.slots != NULL) {
+			cached = (jodyhash_t *)hashset_insert(&cache, &key, sizeof(key), &inserted);
+			if (cached != NULL) *cached = hf->hash;
+		}
+		pthread_mutex_unlock(&cache_lock);
+	}
+	return;
+}
+
+
+static void *worker(void *arg)
+{
+	struct hashfile hf;
+	jodyhash_t *buf;
+	char reply[256];
+
+	(void)arg;
+	memset(&hf, 0, sizeof(hf));
+	hf.want = HF_HASH;
+	buf = (jodyhash_t *)malloc(DAEMON_BSIZE);
+
+	while (1) {
+		struct job *j;
+		int skip;
+
+		pthread_mutex_lock(&lock);
+		while (queue_head == NULL && !stopping) pthread_cond_wait(&work, &lock);
+		j = queue_head;
+		if (j == NULL) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		queue_head = j->next;
+		if (queue_head == NULL) queue_tail = NULL;
+		/* Nobody is left to read the answer */
+		skip = j->c->closed;
+		pthread_mutex_unlock(&lock);
+
+		if (skip) {
+			if (j->fd >= 0) close(j->fd);
+		} else if (buf == NULL) {
+			snprintf(reply, sizeof(reply), "%llu error out of memory\n", j->id);
+			if (j->fd >= 0) close(j->fd);
+		} else run_job(j, &hf, buf, reply, sizeof(reply));
+
+		pthread_mutex_lock(&lock);
+		if (!skip && conn_reply(j->c, reply) != 0) j->c->closed = 1;
+		j->c->pending--;
+		pthread_mutex_unlock(&lock);
+		free(j);
+		wake_main();
+	}
+	free(buf);
+	return NULL;
+}
+
+
+/* Parse one request line and queue it; call with lock held */
+static int handle_request(struct conn *c, char *line)
+{
+	char reply[128];
+	unsigned long long id;
+	struct job *j;
+	size_t len;
+	char *p;
+
+	errno = 0;
+	id = strtoull(line, &p, 10);
+	if (p == line || *p != ' ' || errno != 0) return conn_reply(c, "0 error bad request\n");
+	p++;
+	len = strlen(p);
+	if (strcmp(p, "-") != 0 && *p != '/') {
+		snprintf(reply, sizeof(reply), "%llu error path must be absolute\n", id);
+		return conn_reply(c, reply);
+	}
+	if (*p == '-' && c->nfds == 0) {
+		snprintf(reply, sizeof(reply), "%llu error no descriptor passed\n", id);
+		return conn_reply(c, reply);
+	}
+
+	j = (struct job *)malloc(sizeof(struct job) + len + 1);
+	if (j == NULL) return 1;
+	j->c = c;
+	j->id = id;
+	j->fd = -1;
+	j->next = NULL;
+	memcpy(j->path, p, len + 1);
+	if (*p == '-') {
+		j->fd = c->fds[0];
+		memmove(c->fds, c->fds + 1, (size_t)(c->nfds - 1) * sizeof(int));
+		c->nfds--;
+	}
+	if (queue_tail != NULL) queue_tail->next = j;
+	else queue_head = j;
+	queue_tail = j;
+	c->pending++;
+	pthread_cond_signal(&work);
+	return 0;
+}
+
+
+/* Read requests and passed descriptors; returns 1 when the connection
+ * should be closed */
+static int conn_read(struct conn *c)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * CONN_MAXFDS)];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t got;
+	char *nl;
+	int ret = 0;
+
+	if (c->inlen == sizeof(c->in)) return 1;
+	iov.iov_base = c->in + c->inlen;
+	iov.iov_len = sizeof(c->in) - c->inlen;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	got = recvmsg(c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (got < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : 1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		size_t nfds;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nfds; i++) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (c->nfds < CONN_MAXFDS) c->fds[c->nfds++] = fd;
+			else close(fd);
+		}
+	}
+	if (got == 0) return 1;
+	c->inlen += (size_t)got;
+
+	pthread_mutex_lock(&lock);
+	while ((nl = (char *)memchr(c->in, '\n', c->inlen)) != NULL) {
+		size_t linelen = (size_t)(nl - c->in) + 1;
+
+		*nl = '\0';
+		if (handle_request(c, c->in) != 0) ret = 1;
+		memmove(c->in, c->in + linelen, c->inlen - linelen);
+		c->inlen -= linelen;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+
+/* Send queued replies; returns 1 when the connection should be closed */
+static int conn_flush(struct conn *c)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&lock);
+	while (c->outlen > 0 && !c->closed) {
+		ssize_t sent = send(c->fd, c->out, c->outlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EINTR) ret = 1;
+			break;
+		}
+		memmove(c->out, c->out + sent, c->outlen - (size_t)sent);
+		c->outlen -= (size_t)sent;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+
+static void conn_close(struct conn *c)
+{
+	pthread_mutex_lock(&lock);
+	c->closed = 1;
+	c->outlen = 0;
+	pthread_mutex_unlock(&lock);
+	close(c->fd);
+	c->fd = -1;
+	for (int i = 0; i < c->nfds; i++) close(c->fds[i]);
+	c->nfds = 0;
+	return;
+}
+
+
+/* Serve hash requests on a UNIX socket until SIGINT or SIGTERM */
+extern int daemon_run(const char *path, int workers)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct conn *conns = NULL;
+	struct pollfd *pfd = NULL;
+	struct conn **pconn = NULL;
+	size_t palloc = 0;
+	pthread_t *threads = NULL;
+	int lfd, nthreads = 0, ret = 1;
+	mode_t mask;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "error: socket path too long: %s\n", path);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0) goto error_socket;
+	/* Replace a stale socket, but not one with a live daemon behind it */
+	if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "error: a daemon is already listening on %s\n", path);
+		close(lfd);
+		return 1;
+	}
+	close(lfd);
+	unlink(path);
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0) goto error_socket;
+	mask = umask(0077);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		umask(mask);
+		close(lfd);
+		goto error_socket;
+	}
+	umask(mask);
+	if (listen(lfd, 128) != 0 || set_nonblock(lfd) != 0) goto error_listen;
+	if (pipe(wake_pipe) != 0 || set_nonblock(wake_pipe[0]) != 0 || set_nonblock(wake_pipe[1]) != 0)
+		goto error_listen;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (hashset_init(&cache, sizeof(jodyhash_t)) != 0) goto error_oom;
+	/* The code path is otherwise picked on first use, which would be a
+	 * race between the workers */
+	jody_hash_set_backend(JODY_HASH_AUTO);
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)workers);
+	if (threads == NULL) goto error_oom;
+	for (; nthreads < workers; nthreads++)
+		if (pthread_create(&threads[nthreads], NULL, worker, NULL) != 0) break;
+	if (nthreads == 0) {
+		fprintf(stderr, "error: cannot start worker threads\n");
+		goto shutdown;
+	}
+	fprintf(stderr, "listening on %s with %d workers\n", path, nthreads);
+
+	while (!got_signal) {
+		size_t n = 2;
+		struct conn **cp;
+		char drain[256];
+
+		for (struct conn *c = conns; c != NULL; c = c->next) n++;
+		if (n > palloc) {
+			struct pollfd *newpfd;
+			struct conn **newpconn;
+
+			palloc = n * 2;
+			newpfd = (struct pollfd *)realloc(pfd, palloc * sizeof(struct pollfd));
+			if (newpfd == NULL) goto error_oom;
+			pfd = newpfd;
+			newpconn = (struct conn **)realloc(pconn, palloc * sizeof(struct conn *));
+			if (newpconn == NULL) goto error_oom;
+			pconn = newpconn;
+		}
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = wake_pipe[0];
+		pfd[1].events = POLLIN;
+		n = 2;
+		pthread_mutex_lock(&lock);
+		for (struct conn *c = conns; c != NULL; c = c->next) {
+			if (c->closed) continue;
+			pfd[n].fd = c->fd;
+			pfd[n].events = (short)(POLLIN | ((c->outlen > 0) ? POLLOUT : 0));
+			pconn[n++] = c;
+		}
+		pthread_mutex_unlock(&lock);
+
+		if (poll(pfd, (nfds_t)n, -1) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "error: poll failed\n");
+			break;
+		}
+
+		/* New replies are sent right away below */
+		if (pfd[1].revents & POLLIN) while (read(wake_pipe[0], drain, sizeof(drain)) > 0) continue;
+
+		for (size_t i = 2; i < n; i++) {
+			struct conn *c = pconn[i];
+
+			if ((pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && conn_read(c) != 0) {
+				conn_close(c);
+				continue;
+			}
+			if (conn_flush(c) != 0) conn_close(c);
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int fd;
+
+			while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+				struct conn *c = (struct conn *)calloc(1, sizeof(struct conn));
+
+				if (c == NULL || set_nonblock(fd) != 0) {
+					free(c);
+					close(fd);
+					continue;
+				}
+				c->fd = fd;
+				c->next = conns;
+				conns = c;
+			}
+		}
+
+		/* Free connections that are closed and have no jobs left */
+		pthread_mutex_lock(&lock);
+		cp = &conns;
+		while (*cp != NULL) {
+			struct conn *c = *cp;
+
+			if (c->closed && c->pending == 0) {
+				*cp = c->next;
+				/* Closed by a worker that ran out of memory */
+				if (c->fd >= 0) close(c->fd);
+				for (int i = 0; i < c->nfds; i++) close(c->fds[i]);
+				free(c->out);
+				free(c);
+			} else cp = &c->next;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	ret = 0;
+	goto shutdown;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+shutdown:
+	close(lfd);
+	unlink(path);
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	for (struct conn *c = conns; c != NULL; c = c->next) c->closed = 1;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+	for (int t = 0; t < nthreads; t++) pthread_join(threads[t], NULL);
+	while (conns != NULL) {
+		struct conn *c = conns;
+
+		conns = c->next;
+		if (c->fd >= 0) close(c->fd);
+		for (int i = 0; i < c->nfds; i++) close(c->fds[i]);
+		free(c->out);
+		free(c);
+	}
+	if (cache.slots != NULL) hashset_free(&cache);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+	free(threads);
+	free(pfd);
+	free(pconn);
+	return ret;
+
+error_listen:
+	fprintf(stderr, "error: cannot listen on %s\n", path);
+	close(lfd);
+	unlink(path);
+	return 1;
+error_socket:
+	fprintf(stderr, "error: cannot create socket %s: %s\n", path, strerror(errno));
+	return 1;
+}
+
+
+/* Send a whole request, passing fd along with it if fd >= 0 */
+static int send_request(int sock, const char *req, size_t len, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t sent;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)(uintptr_t)req;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	while (len > 0) {
+		sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			return 1;
+		}
+		/* The descriptor went with the first byte */
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		len -= (size_t)sent;
+		iov.iov_base = (char *)iov.iov_base + sent;
+		iov.iov_len = len;
+	}
+	return 0;
+}
+
+
+/* Hash names (files or "-" for stdin) through the daemon at path */
+extern int client_run(const char *path, char **names, int count, client_result_t result)
+{
+	struct sockaddr_un addr;
+	char req[PATH_MAX + 32], resolved[PATH_MAX];
+	char reply[512];
+	size_t replylen = 0;
+	jodyhash_t *hashes = NULL;
+	char **errors = NULL;
+	char *done = NULL;
+	int sock, next = 0, remaining = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "error: socket path too long: %s\n", path);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "error: cannot connect to daemon at %s\n", path);
+		if (sock >= 0) close(sock);
+		return 1;
+	}
+
+	hashes = (jodyhash_t *)calloc((size_t)count, sizeof(jodyhash_t));
+	errors = (char **)calloc((size_t)count, sizeof(char *));
+	done = (char *)calloc((size_t)count, 1);
+	if (hashes == NULL || errors == NULL || done == NULL) goto error_oom;
+
+	/* Send everything up front; the daemon works on all of it at once */
+	for (int i = 0; i < count; i++) {
+		int len;
+
+		if (!strcmp(names[i], "-")) {
+			len = snprintf(req, sizeof(req), "%d -\n", i);
+			if (send_request(sock, req, (size_t)len, STDIN_FILENO) != 0) goto error_send;
+		} else if (realpath(names[i], resolved) == NULL || strchr(resolved, '\n') != NULL) {
+			errors[i] = strdup("cannot open");
+			if (errors[i] == NULL) goto error_oom;
+			done[i] = 1;
+			continue;
+		} else {
+			len = snprintf(req, sizeof(req), "%d %s\n", i, resolved);
+			if (send_request(sock, req, (size_t)len, -1) != 0) goto error_send;
+		}
+		remaining++;
+	}
+
+	while (1) {
+		char *nl;
+
+		/* Report results in argument order as soon as possible */
+		while (next < count && done[next]) {
+			result(next, hashes[next], errors[next]);
+			next++;
+		}
+		if (remaining == 0) break;
+
+		while ((nl = (char *)memchr(reply, '\n', replylen)) == NULL) {
+			ssize_t got;
+
+			if (replylen == sizeof(reply)) goto error_reply;
+			got = recv(sock, reply + replylen, sizeof(reply) - replylen, 0);
+			if (got < 0 && errno == EINTR) continue;
+			if (got <= 0) goto error_reply;
+			replylen += (size_t)got;
+		}
+		*nl = '\0';
+		{
+			char *p;
+			unsigned long id = strtoul(reply, &p, 10);
+
+			if (p == reply || *p != ' ' || id >= (unsigned long)count || done[id]) goto error_reply;
+			p++;
+			if (!strncmp(p, "error ", 6)) {
+				errors[id] = strdup(p + 6);
+				if (errors[id] == NULL) goto error_oom;
+			} else hashes[id] = (jodyhash_t)strtoull(p, NULL, 16);
+			done[id] = 1;
+			remaining--;
+		}
+		replylen -= (size_t)(nl + 1 - reply);
+		memmove(reply, nl + 1, replylen);
+	}
+
+	close(sock);
+	for (int i = 0; i < count; i++) free(errors[i]);
+	free(errors);
+	free(hashes);
+	free(done);
+	return 0;
+
+error_send:
+	fprintf(stderr, "error: cannot send request to daemon\n");
+	goto error;
+error_reply:
+	fprintf(stderr, "error: bad or missing reply from daemon\n");
+	goto error;
+error_oom:
+	fprintf(stderr, "out of memory\n");
+error:
+	close(sock);
+	if (errors != NULL) for (int i = 0; i < count; i++) free(errors[i]);
+	free(errors);
+	free(hashes);
+	free(done);
+	return 1;
+}
+
+#else /* _WIN32 */
+
+extern int daemon_run(const char *path, int workers)
+{
+	(void)path; (void)workers;
+	fprintf(stderr, "error: daemon mode needs UNIX sockets\n");
+	return 1;
+}
+
+extern int client_run(const char *path, char **names, int count, client_result_t result)
+{
+	(void)path; (void)names; (void)count; (void)result;
+	fprintf(stderr, "error: client mode needs UNIX sockets\n");
+	return 1;
+}
+
+#endif /* _WIN32 */
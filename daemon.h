@@ -0,0 +1,23 @@
+/* jodyhash utility: local hashing daemon and client (headers)
+ * See utility.c for license information */
+
+#ifndef JH_DAEMON_H
+#define JH_DAEMON_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "jody_hash.h"
+
+/* Called in argument order; error is NULL on success */
+typedef void (*client_result_t)(int index, jodyhash_t hash, const char *error);
+
+extern int daemon_run(const char *path, int workers);
+extern int client_run(const char *path, char **names, int count, client_result_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_DAEMON_H */
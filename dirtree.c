@@ -0,0 +1,904 @@
+/* jodyhash utility: Merkle hashing of directory trees
+ *
+ * Every directory gets a hash of its sorted children: the type, content
+ * hash and name of each child are fed to jodyhash in name order. Equal
+ * trees get equal root hashes no matter where they live, and a change
+ * anywhere below a directory changes its hash, so two trees can be
+ * compared top-down while skipping every subtree whose hashes match.
+ *
+ * A scanned tree can be saved as a text manifest that also keeps each
+ * file's size, mtime, ctime and inode. A later scan that is given the
+ * manifest as a cache reuses the hash of every file whose stat data is
+ * unchanged, so rescanning a mostly unchanged tree reads almost nothing.
+ *
+ * Manifest format: a header line, then one line per entry in depth-first
+ * order with sorted children:
+ *   hash type size mtime ctime inode path
+ * type is one of d/f/l/o (see dirtree.h), times are in nanoseconds, the
+ * root's path is "." and '\' and newline in names are written as \\ and \n
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashfile.h"
+#include "hashutil.h"
+#include "stats.h"
+#include "arena.h"
+#include "dirtree.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define MANIFEST_HEADER "# jodyhash tree manifest v1"
+
+#if JODY_HASH_WIDTH == 64
+#define HASH_FMT "%016" PRIx64
+#define HASH_SCN strtoull
+#endif
+#if JODY_HASH_WIDTH == 32
+#define HASH_FMT "%08" PRIx32
+#define HASH_SCN strtoul
+#endif
+#if JODY_HASH_WIDTH == 16
+#define HASH_FMT "%04" PRIx16
+#define HASH_SCN strtoul
+#endif
+
+#ifdef _WIN32
+#define lstat stat
+#endif
+
+struct scan {
+	struct dirtree *t;
+	struct hashfile hf;
+	jodyhash_t *buf;
+	size_t bufsize;
+	char path[PATH_MAX];
+	/* Directory hash input; padded for jody_block_hash() */
+	char *rec;
+	size_t recsize;
+	int errors;
+};
+
+
+extern void dirtree_init(struct dirtree *t)
+{
+	t->root = NULL;
+	t->path = NULL;
+	t->hashed = 0;
+	t->cached = 0;
+	t->compacted = 0;
+	t->on_dir = NULL;
+	t->on_dir_arg = NULL;
+	arena_init(&t->arena);
+	return;
+}
+
+
+static int cmp_node(const void *a, const void *b)
+{
+	return strcmp((*(struct tnode * const *)a)->name, (*(struct tnode * const *)b)->name);
+}
+
+
+/* Binary search of a directory's children */
+static struct tnode *find_child(const struct tnode *dir, const char *name)
+{
+	size_t lo = 0, hi;
+
+	if (dir == NULL || dir->type != TN_DIR) return NULL;
+	hi = dir->nchild;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int c = strcmp(dir->child[mid]->name, name);
+
+		if (c == 0) return dir->child[mid];
+		if (c < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return NULL;
+}
+
+
+/* Sort collected children and move the list into the arena */
+static int set_children(struct dirtree *t, struct tnode *dir, struct tnode **list, size_t n)
+{
+	if (n > UINT32_MAX) return 1;
+	qsort(list, n, sizeof(struct tnode *), cmp_node);
+	dir->nchild = (uint32_t)n;
+	dir->child = NULL;
+	if (n == 0) return 0;
+	dir->child = (struct tnode **)arena_alloc(&t->arena, n * sizeof(struct tnode *));
+	if (dir->child == NULL) return 1;
+	memcpy(dir->child, list, n * sizeof(struct tnode *));
+	return 0;
+}
+
+
+/* A directory's hash covers each child's type, hash and name in order */
+static int hash_dir(struct scan *s, struct tnode *dir)
+{
+	size_t len = 0;
+
+	for (uint32_t i = 0; i < dir->nchild; i++) {
+		const struct tnode *c = dir->child[i];
+		size_t need = len + 1 + JODY_HASH_WIDTH / 4 + 1 + strlen(c->name) + 1;
+
+		if (need + sizeof(jodyhash_t) > s->recsize) {
+			char *newrec;
+			size_t newsize = s->recsize * 2;
+
+			while (need + sizeof(jodyhash_t) > newsize) newsize *= 2;
+			newrec = (char *)realloc(s->rec, newsize);
+			if (newrec == NULL) return 1;
+			s->rec = newrec;
+			s->recsize = newsize;
+		}
+		s->rec[len++] = c->type;
+		for (int shift = JODY_HASH_WIDTH - 4; shift >= 0; shift -= 4)
+			s->rec[len++] = "0123456789abcdef"[(c->hash >> shift) & 0xfU];
+		s->rec[len++] = ' ';
+		strcpy(s->rec + len, c->name);
+		len += strlen(c->name) + 1;
+	}
+	dir->hash = 0;
+	if (jody_block_hash((jodyhash_t *)(void *)s->rec, &dir->hash, len) != 0) return 1;
+	return 0;
+}
+
+
+static int scan_file(struct scan *s, struct tnode *node, const struct tnode *cached)
+{
+	FILE *fp;
+
+	if (cached != NULL && cached->type == TN_FILE && cached->size == node->size
+			&& cached->mtime == node->mtime && cached->ctime == node->ctime
+			&& cached->ino == node->ino) {
+		node->hash = cached->hash;
+		s->t->cached++;
+		return 0;
+	}
+
+	fp = fopen(s->path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "error: cannot open: %s\n", s->path);
+		return 1;
+	}
+	STATS_FILE();
+	hashfile_reset(&s->hf);
+	if (hashfile_read(&s->hf, fp, s->buf, s->bufsize) != HF_OK) {
+		fprintf(stderr, "error reading file: %s\n", s->path);
+		fclose(fp);
+		return 1;
+	}
+	STATS_BYTES(s->hf.bytes);
+	fclose(fp);
+	node->hash = s->hf.hash;
+	s->t->hashed++;
+	return 0;
+}
+
+
+/* Read a directory's entry names into new nodes sorted by name.
+ * Returns 0, 1 when out of memory, -1 if the directory can't be read. */
+static int read_names(struct scan *s, struct tnode ***listp, size_t *np)
+{
+	struct tnode **list = NULL;
+	size_t n = 0, alloc = 0;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(s->path);
+	if (d == NULL) return -1;
+	while ((de = readdir(d)) != NULL) {
+		struct tnode *node;
+		size_t namelen;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+		if (n == alloc) {
+			struct tnode **newlist;
+
+			alloc = alloc ? alloc * 2 : 64;
+			newlist = (struct tnode **)realloc(list, alloc * sizeof(struct tnode *));
+			if (newlist == NULL) goto error_oom;
+			list = newlist;
+		}
+		namelen = strlen(de->d_name) + 1;
+		node = (struct tnode *)arena_alloc(&s->t->arena, sizeof(struct tnode) + namelen);
+		if (node == NULL) goto error_oom;
+		memset(node, 0, sizeof(struct tnode));
+		memcpy(node + 1, de->d_name, namelen);
+		node->name = (const char *)(node + 1);
+		list[n++] = node;
+	}
+	closedir(d);
+	/* Processing in name order keeps error messages deterministic */
+	if (n > 1) qsort(list, n, sizeof(struct tnode *), cmp_node);
+	*listp = list;
+	*np = n;
+	return 0;
+
+error_oom:
+	closedir(d);
+	free(list);
+	return 1;
+}
+
+
+static int scan_dir(struct scan *s, struct tnode *dir, const struct tnode *cached);
+
+/* Fill in the entry at s->path. For files, cached supplies the hash if
+ * the stat data matches; with reuse set, a cached directory with the
+ * same inode is taken over whole instead of being scanned. Returns 0,
+ * 1 if the entry was reported and should be left out, 2 when out of
+ * memory. */
+static int scan_entry(struct scan *s, struct tnode *node, const struct tnode *cached, int reuse)
+{
+	struct stat st;
+
+	if (lstat(s->path, &st) != 0) {
+		fprintf(stderr, "error: cannot stat: %s\n", s->path);
+		return 1;
+	}
+	node->size = (uint64_t)st.st_size;
+	node->mtime = ST_NSEC(st, m);
+	node->ctime = ST_NSEC(st, c);
+	node->ino = (uint64_t)st.st_ino;
+
+	if (S_ISDIR(st.st_mode)) {
+		node->type = TN_DIR;
+		node->size = 0;
+		if (reuse && cached != NULL && cached->type == TN_DIR && cached->ino == node->ino) {
+			node->child = cached->child;
+			node->nchild = cached->nchild;
+			node->hash = cached->hash;
+			return 0;
+		}
+		if (scan_dir(s, node, cached) != 0) return 2;
+	} else if (S_ISREG(st.st_mode)) {
+		node->type = TN_FILE;
+		if (scan_file(s, node, cached) != 0) return 1;
+#ifndef _WIN32
+	} else if (S_ISLNK(st.st_mode)) {
+		ssize_t len;
+
+		node->type = TN_LINK;
+		len = readlink(s->path, (char *)s->buf, s->bufsize);
+		if (len < 0 || (size_t)len >= s->bufsize - sizeof(jodyhash_t)) {
+			fprintf(stderr, "error: cannot read link: %s\n", s->path);
+			return 1;
+		}
+		if (jody_block_hash(s->buf, &node->hash, (size_t)len) != 0) return 2;
+#endif
+	} else node->type = TN_OTHER;
+	return 0;
+}
+
+
+/* Append name to s->path; returns the old length, or 0 if too long */
+static size_t path_push(struct scan *s, const char *name)
+{
+	size_t base = strlen(s->path);
+
+	if (base + 1 + strlen(name) >= PATH_MAX) {
+		fprintf(stderr, "error: path too long: %s/%s\n", s->path, name);
+		return 0;
+	}
+	s->path[base] = '/';
+	strcpy(s->path + base + 1, name);
+	return base;
+}
+
+
+/* Scan the directory at s->path. Unreadable entries are reported and
+ * left out, so the hashes above them can't be trusted. */
+static int scan_dir(struct scan *s, struct tnode *dir, const struct tnode *cached)
+{
+	struct tnode **list = NULL;
+	size_t n = 0, kept = 0;
+
+	dir->nchild = 0;
+	dir->child = NULL;
+	if (s->t->on_dir != NULL) s->t->on_dir(s->path, s->t->on_dir_arg);
+	switch (read_names(s, &list, &n)) {
+		case 0: break;
+		case -1:
+			fprintf(stderr, "error: cannot open directory: %s\n", s->path);
+			s->errors++;
+			return hash_dir(s, dir);
+		default: return 1;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		struct tnode *node = list[i];
+		size_t base = path_push(s, node->name);
+
+		if (base == 0) {
+			s->errors++;
+			continue;
+		}
+		switch (scan_entry(s, node, find_child(cached, node->name), 0)) {
+			case 0: list[kept++] = node; break;
+			case 1: s->errors++; break;
+			default:
+				free(list);
+				return 1;
+		}
+		s->path[base] = '\0';
+	}
+	if (set_children(s->t, dir, list, kept) != 0) {
+		free(list);
+		return 1;
+	}
+	free(list);
+	return hash_dir(s, dir);
+}
+
+
+static int scan_init(struct scan *s, struct dirtree *t, jodyhash_t *buf, size_t bufsize)
+{
+	memset(s, 0, sizeof(struct scan));
+	s->t = t;
+	s->hf.want = HF_HASH;
+	s->buf = buf;
+	s->bufsize = bufsize;
+	s->recsize = 65536;
+	s->rec = (char *)malloc(s->recsize);
+	return (s->rec == NULL) ? 1 : 0;
+}
+
+
+/* Hash the tree under path, reusing file hashes from cache (may be NULL)
+ * when the stat data matches. Returns 0 on success, 1 if some entries
+ * could not be read (the tree is still usable), 2 on fatal errors. */
+extern int dirtree_scan(struct dirtree *t, const char *path, const struct dirtree *cache,
+		jodyhash_t *buf, size_t bufsize)
+{
+	struct scan s;
+	struct stat st;
+	size_t len = strlen(path);
+
+	if (len >= PATH_MAX) {
+		fprintf(stderr, "error: path too long: %s\n", path);
+		return 2;
+	}
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "error: not a directory: %s\n", path);
+		return 2;
+	}
+	if (scan_init(&s, t, buf, bufsize) != 0) goto error_oom;
+	memcpy(s.path, path, len + 1);
+	/* Keep "dir/" from turning into "dir//name" */
+	while (len > 1 && s.path[len - 1] == '/') s.path[--len] = '\0';
+	free(t->path);
+	t->path = strdup(s.path);
+	if (t->path == NULL) goto error_oom;
+
+	t->root = (struct tnode *)arena_alloc(&t->arena, sizeof(struct tnode));
+	if (t->root == NULL) goto error_oom;
+	memset(t->root, 0, sizeof(struct tnode));
+	t->root->name = ".";
+	t->root->type = TN_DIR;
+	if (scan_dir(&s, t->root, (cache != NULL) ? cache->root : NULL) != 0) goto error_oom;
+	free(s.rec);
+	t->compacted = t->arena.total;
+	return (s.errors != 0) ? 1 : 0;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+	free(s.rec);
+	t->root = NULL;
+	return 2;
+}
+
+
+static void put_path(FILE *fp, const char *path)
+{
+	for (; *path != '\0'; path++) {
+		if (*path == '\\') fputs("\\\\", fp);
+		else if (*path == '\n') fputs("\\n", fp);
+		else fputc(*path, fp);
+	}
+	return;
+}
+
+
+/* Returns the number of entries that could not be written */
+static uint64_t save_node(const struct tnode *node, char *path, size_t len, FILE *fp)
+{
+	uint64_t skipped = 0;
+
+	fprintf(fp, HASH_FMT " %c %" PRIu64 " %" PRId64 " %" PRId64 " %" PRIu64 " ",
+			node->hash, node->type, node->size, node->mtime, node->ctime, node->ino);
+	put_path(fp, (len == 0) ? "." : path);
+	fputc('\n', fp);
+	for (uint32_t i = 0; i < node->nchild; i++) {
+		size_t namelen = strlen(node->child[i]->name);
+
+		/* Manifests from other systems may have deeper paths than PATH_MAX */
+		if (len + namelen + 2 > PATH_MAX) {
+			fprintf(stderr, "error: path too long for manifest: %s/%s\n", path, node->child[i]->name);
+			skipped++;
+			continue;
+		}
+		if (len > 0) path[len] = '/';
+		memcpy(path + len + (len > 0), node->child[i]->name, namelen + 1);
+		skipped += save_node(node->child[i], path, len + (len > 0) + namelen, fp);
+		path[len] = '\0';
+	}
+	return skipped;
+}
+
+
+extern int dirtree_save(const struct dirtree *t, FILE *fp)
+{
+	char path[PATH_MAX];
+
+	path[0] = '\0';
+	fprintf(fp, "%s width %d\n", MANIFEST_HEADER, JODY_HASH_WIDTH);
+	if (save_node(t->root, path, 0, fp) != 0) {
+		fflush(fp);
+		return 1;
+	}
+	if (fflush(fp) != 0 || ferror(fp)) return 1;
+	return 0;
+}
+
+
+/* Undo put_path() escaping in place; returns 1 on a bad escape */
+static int unescape(char *s)
+{
+	char *out = s;
+
+	for (; *s != '\0'; s++) {
+		if (*s != '\\') {
+			*out++ = *s;
+			continue;
+		}
+		s++;
+		if (*s == '\\') *out++ = '\\';
+		else if (*s == 'n') *out++ = '\n';
+		else return 1;
+	}
+	*out = '\0';
+	return 0;
+}
+
+
+/* One directory level being filled in while loading a manifest */
+struct level {
+	struct tnode *dir;
+	size_t pathlen;  /* Length of the directory's path in dirpath */
+	struct tnode **list;
+	size_t n;
+	size_t alloc;
+};
+
+
+/* Read a manifest written by dirtree_save(). Returns 0 on success,
+ * 1 on read errors or when out of memory, 2 for a bad manifest. */
+extern int dirtree_load(struct dirtree *t, FILE *fp)
+{
+	struct linereader lr;
+	struct level *stack = NULL;
+	size_t depth_alloc = 0;
+	size_t top = 0;
+	char header[64];
+	char *line, *p, *copyline = NULL;
+	/* Path of the deepest open directory; each level's path is a prefix */
+	char *dirpath = NULL;
+	size_t len, copysize = 0, dirpath_alloc = 0;
+	int ret, status = 2;
+
+	if (lines_open(&lr, fp) != 0) return 1;
+	snprintf(header, sizeof(header), "%s width %d", MANIFEST_HEADER, JODY_HASH_WIDTH);
+	ret = lines_next(&lr, &line, &len);
+	if (ret <= 0 || len != strlen(header) || memcmp(line, header, len) != 0) {
+		status = (ret < 0) ? 1 : 2;
+		goto error;
+	}
+
+	while ((ret = lines_next(&lr, &line, &len)) > 0) {
+		struct tnode node, *copy;
+		size_t depth = 0, namelen;
+		const char *name;
+		char *end;
+
+		if (len == 0 || memchr(line, '\0', len) != NULL) goto error;
+		/* Lines aren't terminated inside the reader's buffer */
+		if (len + 1 > copysize) {
+			char *newline = (char *)realloc(copyline, len + 1);
+
+			if (newline == NULL) goto error_oom;
+			copyline = newline;
+			copysize = len + 1;
+		}
+		memcpy(copyline, line, len);
+		copyline[len] = '\0';
+		line = copyline;
+		memset(&node, 0, sizeof(node));
+		node.hash = (jodyhash_t)HASH_SCN(line, &end, 16);
+		if (end == line || *end != ' ') goto error;
+		p = end + 1;
+		node.type = *p++;
+		if (*p++ != ' ') goto error;
+		node.size = strtoull(p, &end, 10);
+		node.mtime = strtoll(end, &end, 10);
+		node.ctime = strtoll(end, &end, 10);
+		node.ino = strtoull(end, &end, 10);
+		if (*end != ' ') goto error;
+		p = end + 1;
+		if (unescape(p) != 0) goto error;
+
+		/* The root comes first; everything else is relative to it */
+		if (t->root == NULL) {
+			if (strcmp(p, ".") != 0 || node.type != TN_DIR) goto error;
+			name = ".";
+		} else {
+			depth = 1;
+			for (char *c = p; *c != '\0'; c++) if (*c == '/') depth++;
+			name = strrchr(p, '/');
+			name = (name != NULL) ? name + 1 : p;
+			if (*name == '\0' || !strcmp(name, ".") || !strcmp(name, "..") || depth > top) goto error;
+			/* Everything before the name must be the parent's path */
+			if ((size_t)(name - p) != stack[depth - 1].pathlen + (depth > 1)
+					|| memcmp(p, dirpath, stack[depth - 1].pathlen) != 0) goto error;
+		}
+		if (node.type != TN_DIR && node.type != TN_FILE && node.type != TN_LINK && node.type != TN_OTHER)
+			goto error;
+
+		namelen = strlen(name) + 1;
+		copy = (struct tnode *)arena_alloc(&t->arena, sizeof(struct tnode) + namelen);
+		if (copy == NULL) goto error_oom;
+		*copy = node;
+		memcpy(copy + 1, name, namelen);
+		copy->name = (const char *)(copy + 1);
+		if (t->root == NULL) t->root = copy;
+		else {
+			struct level *parent;
+
+			/* Depth-first order: this entry's parent is the open
+			 * directory one level up; finish anything deeper */
+			while (top > depth) {
+				if (set_children(t, stack[top - 1].dir, stack[top - 1].list, stack[top - 1].n) != 0)
+					goto error_oom;
+				top--;
+			}
+			parent = &stack[depth - 1];
+			if (parent->n == parent->alloc) {
+				struct tnode **newlist;
+
+				parent->alloc = parent->alloc ? parent->alloc * 2 : 64;
+				newlist = (struct tnode **)realloc(parent->list, parent->alloc * sizeof(struct tnode *));
+				if (newlist == NULL) goto error_oom;
+				parent->list = newlist;
+			}
+			parent->list[parent->n++] = copy;
+		}
+
+		if (copy->type == TN_DIR) {
+			if (top == depth_alloc) {
+				struct level *newstack;
+
+				depth_alloc = depth_alloc ? depth_alloc * 2 : 32;
+				newstack = (struct level *)realloc(stack, depth_alloc * sizeof(struct level));
+				if (newstack == NULL) goto error_oom;
+				memset(newstack + top, 0, (depth_alloc - top) * sizeof(struct level));
+				stack = newstack;
+			}
+			stack[top].dir = copy;
+			stack[top].n = 0;
+			stack[top].pathlen = 0;
+			if (depth > 0) {
+				size_t plen = strlen(p);
+
+				if (plen + 1 > dirpath_alloc) {
+					char *newpath = (char *)realloc(dirpath, plen + 1);
+
+					if (newpath == NULL) goto error_oom;
+					dirpath = newpath;
+					dirpath_alloc = plen + 1;
+				}
+				memcpy(dirpath, p, plen + 1);
+				stack[top].pathlen = plen;
+			}
+			top++;
+		}
+	}
+	if (ret < 0) {
+		status = 1;
+		goto error;
+	}
+	if (t->root == NULL) goto error;
+	while (top > 0) {
+		if (set_children(t, stack[top - 1].dir, stack[top - 1].list, stack[top - 1].n) != 0)
+			goto error_oom;
+		top--;
+	}
+	for (size_t i = 0; i < depth_alloc; i++) free(stack[i].list);
+	free(stack);
+	free(copyline);
+	free(dirpath);
+	lines_close(&lr);
+	t->compacted = t->arena.total;
+	return 0;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+	status = 1;
+error:
+	for (size_t i = 0; i < depth_alloc; i++) free(stack[i].list);
+	free(stack);
+	free(copyline);
+	free(dirpath);
+	lines_close(&lr);
+	t->root = NULL;
+	return status;
+}
+
+
+static void report(FILE *out, char change, const char *path, const struct tnode *node)
+{
+	fprintf(out, "%c ", change);
+	put_path(out, path);
+	if (node->type == TN_DIR) fputc('/', out);
+	fputc('\n', out);
+	return;
+}
+
+
+/* Top-down comparison: subtrees with equal hashes are never entered */
+static uint64_t compare_node(const struct tnode *a, const struct tnode *b, char *path, size_t len, FILE *out)
+{
+	uint64_t changes = 0;
+	uint32_t i = 0, j = 0;
+
+	if (a->type == b->type && a->hash == b->hash) return 0;
+	if (a->type != TN_DIR || b->type != TN_DIR) {
+		if (a->type != b->type) {
+			report(out, '-', path, a);
+			report(out, '+', path, b);
+		} else report(out, 'M', path, a);
+		return 1;
+	}
+
+	/* Merge the two sorted child lists */
+	while (i < a->nchild || j < b->nchild) {
+		const struct tnode *ca = (i < a->nchild) ? a->child[i] : NULL;
+		const struct tnode *cb = (j < b->nchild) ? b->child[j] : NULL;
+		const char *name;
+		size_t namelen;
+		int c;
+
+		if (ca == NULL) c = 1;
+		else if (cb == NULL) c = -1;
+		else c = strcmp(ca->name, cb->name);
+		name = (c <= 0) ? ca->name : cb->name;
+		namelen = strlen(name);
+		if (len + namelen + 2 > PATH_MAX) {
+			fprintf(stderr, "error: path too long: %s/%s\n", path, name);
+			if (c <= 0) i++;
+			if (c >= 0) j++;
+			continue;
+		}
+		if (len > 0) path[len] = '/';
+		memcpy(path + len + (len > 0), name, namelen + 1);
+		if (c < 0) {
+			report(out, '-', path, ca);
+			changes++;
+			i++;
+		} else if (c > 0) {
+			report(out, '+', path, cb);
+			changes++;
+			j++;
+		} else {
+			changes += compare_node(ca, cb, path, len + (len > 0) + namelen, out);
+			i++;
+			j++;
+		}
+		path[len] = '\0';
+	}
+	return changes;
+}
+
+
+/* Print the differences between two trees as "- path" (only in a),
+ * "+ path" (only in b) and "M path" (changed); returns their number */
+extern uint64_t dirtree_compare(const struct dirtree *a, const struct dirtree *b, FILE *out)
+{
+	char path[PATH_MAX];
+
+	path[0] = '\0';
+	return compare_node(a->root, b->root, path, 0, out);
+}
+
+
+static void event(FILE *out, char change, const char *rel, const struct tnode *node)
+{
+	fprintf(out, "%c ", change);
+	if (change != '-') fprintf(out, HASH_FMT " ", node->hash);
+	put_path(out, rel);
+	if (node->type == TN_DIR) fputc('/', out);
+	fputc('\n', out);
+	return;
+}
+
+
+/* Bring one directory of a scanned tree up to date. rel is relative to
+ * the scanned root ("" for the root itself). Subdirectories that are
+ * still the same directory are kept as they are; changes inside them
+ * are refreshed separately. Files in force (relative paths, may be
+ * NULL) are hashed even if their stat data looks unchanged. Changes are
+ * written to events as "+ HASH path", "M HASH path" and "- path", and
+ * the hashes of the directory and everything above it are updated.
+ * Returns 0, 1 if some entries could not be read, 2 when out of memory. */
+extern int dirtree_refresh(struct dirtree *t, const char *rel, const struct hashset *force,
+		jodyhash_t *buf, size_t bufsize, FILE *events)
+{
+	struct scan s;
+	struct tnode **chain = NULL, **list = NULL, *dir;
+	char relpath[PATH_MAX];
+	size_t rellen = strlen(rel), depth = 0, n = 0, kept = 0, plen;
+	int ret = 0;
+
+	if (t->root == NULL || t->path == NULL) return 2;
+	if (scan_init(&s, t, buf, bufsize) != 0) goto error_oom;
+	plen = strlen(t->path);
+	if (plen + 1 + rellen >= PATH_MAX) goto done;
+	memcpy(s.path, t->path, plen + 1);
+	if (rellen > 0) {
+		s.path[plen] = '/';
+		memcpy(s.path + plen + 1, rel, rellen + 1);
+	}
+
+	/* Find the directory, remembering the way back up */
+	chain = (struct tnode **)malloc((rellen / 2 + 2) * sizeof(struct tnode *));
+	if (chain == NULL) goto error_oom;
+	dir = t->root;
+	chain[depth++] = dir;
+	memcpy(relpath, rel, rellen + 1);
+	for (char *p = relpath, *next; *p != '\0'; p = next) {
+		next = strchr(p, '/');
+		if (next != NULL) *next++ = '\0';
+		else next = p + strlen(p);
+		dir = find_child(dir, p);
+		/* Gone already; refreshing its parent drops it */
+		if (dir == NULL || dir->type != TN_DIR) goto done;
+		chain[depth++] = dir;
+	}
+	if (rellen > 0) {
+		struct stat st;
+
+		/* Its own entry changes along with its contents */
+		if (lstat(s.path, &st) != 0 || !S_ISDIR(st.st_mode)) goto done;
+		dir->mtime = ST_NSEC(st, m);
+		dir->ctime = ST_NSEC(st, c);
+		dir->ino = (uint64_t)st.st_ino;
+	}
+
+	switch (read_names(&s, &list, &n)) {
+		case 0: break;
+		case -1: goto done;
+		default: goto error_oom;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		struct tnode *node = list[i], *old;
+		size_t base = path_push(&s, node->name);
+		int forced;
+
+		if (base == 0 || rellen + 1 + strlen(node->name) >= PATH_MAX) {
+			ret = 1;
+			continue;
+		}
+		if (rellen > 0) sprintf(relpath, "%s/%s", rel, node->name);
+		else strcpy(relpath, node->name);
+		old = find_child(dir, node->name);
+		forced = (force != NULL && hashset_find(force, relpath, strlen(relpath)) != NULL);
+		switch (scan_entry(&s, node, forced ? NULL : old, 1)) {
+			case 0: break;
+			case 1:
+				ret = 1;
+				s.path[base] = '\0';
+				continue;
+			default: goto error_oom;
+		}
+		s.path[base] = '\0';
+		list[kept++] = node;
+
+		if (old == NULL) event(events, '+', relpath, node);
+		else if (old->type != node->type) {
+			event(events, '-', relpath, old);
+			event(events, '+', relpath, node);
+		} else if (old->hash != node->hash) event(events, 'M', relpath, node);
+	}
+
+	/* Both lists are sorted; anything only in the old one is gone */
+	for (size_t i = 0, j = 0; i < dir->nchild; i++) {
+		int c = 1;
+
+		while (j < kept && (c = strcmp(list[j]->name, dir->child[i]->name)) < 0) j++;
+		if (j < kept && c == 0) continue;
+		if (rellen + 1 + strlen(dir->child[i]->name) >= PATH_MAX) continue;
+		if (rellen > 0) sprintf(relpath, "%s/%s", rel, dir->child[i]->name);
+		else strcpy(relpath, dir->child[i]->name);
+		event(events, '-', relpath, dir->child[i]);
+	}
+
+	if (set_children(t, dir, list, kept) != 0) goto error_oom;
+	for (size_t k = depth; k > 0; k--) if (hash_dir(&s, chain[k - 1]) != 0) goto error_oom;
+	goto done;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+	ret = 2;
+done:
+	free(list);
+	free(chain);
+	free(s.rec);
+	return ret;
+}
+
+
+static struct tnode *copy_node(struct arena *a, const struct tnode *node)
+{
+	size_t namelen = strlen(node->name) + 1;
+	struct tnode *copy = (struct tnode *)arena_alloc(a, sizeof(struct tnode) + namelen);
+
+	if (copy == NULL) return NULL;
+	*copy = *node;
+	memcpy(copy + 1, node->name, namelen);
+	copy->name = (const char *)(copy + 1);
+	if (node->nchild == 0) return copy;
+	copy->child = (struct tnode **)arena_alloc(a, node->nchild * sizeof(struct tnode *));
+	if (copy->child == NULL) return NULL;
+	for (uint32_t i = 0; i < node->nchild; i++)
+		if ((copy->child[i] = copy_node(a, node->child[i])) == NULL) return NULL;
+	return copy;
+}
+
+
+/* Refreshes leave replaced nodes behind in the arena; once they could
+ * make up half of it, copy the live tree into a fresh arena */
+extern int dirtree_compact(struct dirtree *t)
+{
+	struct tnode *root;
+	struct arena a;
+
+	if (t->root == NULL || t->arena.total < t->compacted * 2 + ARENA_CHUNK) return 0;
+	arena_init(&a);
+	root = copy_node(&a, t->root);
+	if (root == NULL) {
+		arena_free(&a);
+		return 1;
+	}
+	arena_free(&t->arena);
+	t->arena = a;
+	t->root = root;
+	t->compacted = a.total;
+	return 0;
+}
+
+
+extern void dirtree_free(struct dirtree *t)
+{
+	arena_free(&t->arena);
+	free(t->path);
+	t->path = NULL;
+	t->root = NULL;
+	return;
+}
@@ -0,0 +1,63 @@
+/* jodyhash utility: Merkle hashing of directory trees (headers)
+ * See utility.c for license information */
+
+#ifndef JH_DIRTREE_H
+#define JH_DIRTREE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "jody_hash.h"
+#include "arena.h"
+#include "hashset.h"
+
+/* Node types as written in manifests */
+#define TN_DIR   'd'
+#define TN_FILE  'f'
+#define TN_LINK  'l'  /* Hash of the link target */
+#define TN_OTHER 'o'  /* Devices, FIFOs, sockets; hash is zero */
+
+struct tnode {
+	const char *name;
+	struct tnode **child;  /* Sorted by name */
+	uint32_t nchild;
+	char type;
+	jodyhash_t hash;
+	/* Stat data used to reuse the hash of unchanged files */
+	uint64_t size;
+	int64_t mtime;  /* Nanoseconds */
+	int64_t ctime;
+	uint64_t ino;
+};
+
+struct dirtree {
+	struct tnode *root;
+	char *path;       /* Scanned directory; NULL for loaded manifests */
+	struct arena arena;
+	uint64_t hashed;  /* Files read during a scan */
+	uint64_t cached;  /* Files whose hash came from the cache */
+	size_t compacted; /* Arena size after the last scan or compaction */
+	/* Called with the full path of each directory before it is read */
+	void (*on_dir)(const char *path, void *arg);
+	void *on_dir_arg;
+};
+
+extern void dirtree_init(struct dirtree *t);
+extern int dirtree_scan(struct dirtree *t, const char *path, const struct dirtree *cache,
+		jodyhash_t *buf, size_t bufsize);
+extern int dirtree_load(struct dirtree *t, FILE *fp);
+extern int dirtree_save(const struct dirtree *t, FILE *fp);
+extern uint64_t dirtree_compare(const struct dirtree *a, const struct dirtree *b, FILE *out);
+extern int dirtree_refresh(struct dirtree *t, const char *rel, const struct hashset *force,
+		jodyhash_t *buf, size_t bufsize, FILE *events);
+extern int dirtree_compact(struct dirtree *t);
+extern void dirtree_free(struct dirtree *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_DIRTREE_H */
@@ -0,0 +1,236 @@
+/* jodyhash utility: single-pass file hashing engine
+ *
+ * Computes any combination of the whole-file hash, per-block hashes,
+ * the rolling block hash, and prefix hashes from a single read of the
+ * input data. Holes in sparse files are hashed without reading them.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashfile.h"
+#include "stats.h"
+
+/* Clear all results; requested outputs and callbacks are kept */
+extern void hashfile_reset(struct hashfile *hf)
+{
+	hf->hash = 0;
+	hf->roll = 0;
+	for (int p = 0; p < HF_MAX_PREFIXES; p++) hf->prefix[p] = 0;
+	hf->bytes = 0;
+	return;
+}
+
+
+/* Feed the next piece of data to every requested output. Every piece
+ * except the last one MUST be a multiple of HF_BLOCKSIZE so that the
+ * block and rolling hashes line up with the data. */
+extern int hashfile_update(struct hashfile *hf, jodyhash_t *data, size_t count)
+{
+	if (unlikely(count == 0)) return 0;
+
+	if (hf->want & HF_HASH)
+		if (jody_block_hash(data, &hf->hash, count) != 0) return 1;
+
+	if (hf->want & HF_ROLL)
+		if (jody_rolling_block_hash(data, &hf->roll, count) != 0) return 1;
+
+	if (hf->want & HF_PREFIX) {
+		for (int p = 0; p < hf->prefixes; p++) {
+			size_t plen;
+
+			if (hf->bytes >= hf->prefix_len[p]) continue;
+			plen = (hf->prefix_len[p] - hf->bytes > count) ? count : (size_t)(hf->prefix_len[p] - hf->bytes);
+			if (jody_block_hash(data, &hf->prefix[p], plen) != 0) return 1;
+		}
+	}
+
+	if (hf->want & HF_BLOCKS) {
+		const size_t kboffsize = HF_BLOCKSIZE / sizeof(jodyhash_t);
+		jodyhash_t *kblk = data;
+		size_t remain = count;
+
+		while (remain > 0) {
+			jodyhash_t bhash = 0;
+			size_t kbdrop = (remain > HF_BLOCKSIZE) ? HF_BLOCKSIZE : remain;
+
+			if (jody_block_hash(kblk, &bhash, kbdrop) != 0) return 1;
+			if (hf->block != NULL) hf->block(bhash, hf->block_arg);
+			kblk += kboffsize;
+			remain -= kbdrop;
+		}
+	}
+
+	hf->bytes += count;
+	return 0;
+}
+
+
+/* Feed 'count' zero bytes to every requested output without touching
+ * memory. The same HF_BLOCKSIZE multiple rule as hashfile_update() applies. */
+extern int hashfile_zero(struct hashfile *hf, uint64_t count)
+{
+	const uint64_t step = (uint64_t)1 << 30;
+	jodyhash_t zblock = 0, ztail = 0;
+	uint64_t blocks = count / HF_BLOCKSIZE;
+	size_t tail = (size_t)(count % HF_BLOCKSIZE);
+
+	if (unlikely(count == 0)) return 0;
+
+	if (hf->want & HF_HASH)
+		for (uint64_t done = 0; done < count; done += step)
+			jody_zero_hash(&hf->hash, (size_t)((count - done > step) ? step : count - done));
+
+	if (hf->want & HF_PREFIX) {
+		for (int p = 0; p < hf->prefixes; p++) {
+			uint64_t plen;
+
+			if (hf->bytes >= hf->prefix_len[p]) continue;
+			plen = (hf->prefix_len[p] - hf->bytes > count) ? count : hf->prefix_len[p] - hf->bytes;
+			for (uint64_t done = 0; done < plen; done += step)
+				jody_zero_hash(&hf->prefix[p], (size_t)((plen - done > step) ? step : plen - done));
+		}
+	}
+
+	/* Every whole zero block has the same block hash */
+	if (hf->want & (HF_BLOCKS | HF_ROLL)) {
+		jody_zero_hash(&zblock, HF_BLOCKSIZE);
+		if (tail > 0) jody_zero_hash(&ztail, tail);
+	}
+
+	/* XORing an identical block hash twice cancels it out */
+	if (hf->want & HF_ROLL) {
+		if (blocks & 1) hf->roll ^= zblock;
+		if (tail > 0) hf->roll ^= ztail;
+	}
+
+	if ((hf->want & HF_BLOCKS) && hf->block != NULL) {
+		for (uint64_t b = 0; b < blocks; b++) hf->block(zblock, hf->block_arg);
+		if (tail > 0) hf->block(ztail, hf->block_arg);
+	}
+
+	hf->bytes += count;
+	return 0;
+}
+
+
+/* Prefix-only requests can stop reading once every prefix is complete */
+static int prefixes_done(const struct hashfile *hf)
+{
+	if (hf->want != HF_PREFIX) return 0;
+	for (int p = 0; p < hf->prefixes; p++)
+		if (hf->bytes < hf->prefix_len[p]) return 0;
+	return 1;
+}
+
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+/* Hash a regular file with holes. Data regions are read normally and
+ * whole HF_BLOCKSIZE blocks inside holes are fed in as zeroes without
+ * reading them. Partial blocks at hole edges are simply read. */
+static int hashfile_read_sparse(struct hashfile *hf, FILE *fp, jodyhash_t *buf, size_t bufsize, off_t size)
+{
+	const off_t bmask = HF_BLOCKSIZE - 1;
+	int fd = fileno(fp);
+	off_t pos = 0, data, hole;
+	size_t want, got;
+
+	while (pos < size) {
+		data = lseek(fd, pos, SEEK_DATA);
+		if (data < 0) {
+			/* ENXIO: nothing but a hole up to EOF */
+			if (errno != ENXIO) return HF_ERR_READ;
+			data = size;
+		}
+		if (data > size) data = size;
+		if ((data & ~bmask) > pos) {
+			STATS_PHASE(STATS_HASH);
+			if (hashfile_zero(hf, (uint64_t)((data & ~bmask) - pos)) != 0) return HF_ERR_HASH;
+			pos = data & ~bmask;
+		}
+		if (pos >= size || prefixes_done(hf)) break;
+
+		/* Search from inside the data region so the hole is past 'pos' */
+		if (data < size) {
+			hole = lseek(fd, data, SEEK_HOLE);
+			if (hole < 0) return HF_ERR_READ;
+			hole = (hole + bmask) & ~bmask;
+			if (hole > size) hole = size;
+		} else hole = size;
+
+		if (fseeko(fp, pos, SEEK_SET) != 0) return HF_ERR_READ;
+		while (pos < hole) {
+			want = (hole - pos > (off_t)bufsize) ? bufsize : (size_t)(hole - pos);
+			STATS_PHASE(STATS_IO);
+			got = fread((void *)buf, 1, want, fp);
+			if (ferror(fp)) return HF_ERR_READ;
+			STATS_PHASE(STATS_HASH);
+			if (hashfile_update(hf, buf, got) != 0) return HF_ERR_HASH;
+			pos += (off_t)got;
+			/* The file shrank while we were reading it */
+			if (got < want) return HF_OK;
+			if (prefixes_done(hf)) return HF_OK;
+		}
+	}
+	return HF_OK;
+}
+
+
+/* Check for a seekable regular file that actually contains a hole */
+static int is_sparse(FILE *fp, off_t *size)
+{
+	struct stat st;
+	int fd = fileno(fp);
+	off_t hole;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+	if (ftello(fp) != 0) return 0;
+	/* Fully allocated files can't have holes; skip the extra syscalls */
+	if ((off_t)st.st_blocks * 512 >= st.st_size) return 0;
+	hole = lseek(fd, 0, SEEK_HOLE);
+	if (lseek(fd, 0, SEEK_SET) != 0) return 0;
+	if (hole < 0 || hole >= st.st_size) return 0;
+	*size = st.st_size;
+	return 1;
+}
+#endif /* SEEK_DATA && SEEK_HOLE */
+
+
+/* Read a stream to EOF and hash it; bufsize must be a multiple of HF_BLOCKSIZE */
+extern int hashfile_read(struct hashfile *hf, FILE *fp, jodyhash_t *buf, size_t bufsize)
+{
+	size_t i;
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+	off_t size;
+
+	if (is_sparse(fp, &size)) {
+		int ret = hashfile_read_sparse(hf, fp, buf, bufsize, size);
+
+		STATS_PHASE(STATS_OTHER);
+		return ret;
+	}
+#endif
+
+	while (1) {
+		STATS_PHASE(STATS_IO);
+		if ((i = fread((void *)buf, 1, bufsize, fp)) == 0) break;
+		if (ferror(fp)) return HF_ERR_READ;
+		STATS_PHASE(STATS_HASH);
+		if (hashfile_update(hf, buf, i) != 0) return HF_ERR_HASH;
+		if (feof(fp) || prefixes_done(hf)) break;
+	}
+	STATS_PHASE(STATS_OTHER);
+	if (ferror(fp)) return HF_ERR_READ;
+	return HF_OK;
+}
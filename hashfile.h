@@ -0,0 +1,52 @@
+/* jodyhash utility: single-pass file hashing engine (headers)
+ * See utility.c for license information */
+
+#ifndef HASHFILE_H
+#define HASHFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "jody_hash.h"
+
+/* Outputs that can be computed from one read of the data */
+#define HF_HASH   0x01U  /* Whole-file hash */
+#define HF_BLOCKS 0x02U  /* One hash per HF_BLOCKSIZE block */
+#define HF_ROLL   0x04U  /* Rolling (XORed) HF_BLOCKSIZE block hash */
+#define HF_PREFIX 0x08U  /* Hash of the first N bytes */
+
+/* Block size for HF_BLOCKS and HF_ROLL; must match jody_rolling_block_hash */
+#define HF_BLOCKSIZE 4096
+#define HF_MAX_PREFIXES 8
+
+/* hashfile_read() return values */
+#define HF_OK       0
+#define HF_ERR_READ 1
+#define HF_ERR_HASH 2
+
+struct hashfile {
+	unsigned int want;
+	jodyhash_t hash;
+	jodyhash_t roll;
+	int prefixes;
+	uint64_t prefix_len[HF_MAX_PREFIXES];
+	jodyhash_t prefix[HF_MAX_PREFIXES];
+	/* Called for every block when HF_BLOCKS is requested */
+	void (*block)(jodyhash_t hash, void *arg);
+	void *block_arg;
+	uint64_t bytes;
+};
+
+extern void hashfile_reset(struct hashfile *hf);
+extern int hashfile_update(struct hashfile *hf, jodyhash_t *data, size_t count);
+extern int hashfile_zero(struct hashfile *hf, uint64_t count);
+extern int hashfile_read(struct hashfile *hf, FILE *fp, jodyhash_t *buf, size_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* HASHFILE_H */
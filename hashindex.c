@@ -0,0 +1,269 @@
+/* jodyhash utility: mmap-able sorted index of known hashes
+ *
+ * A list of hashes (for example, earlier -s output) is compiled into a
+ * binary file holding the sorted unique hashes in Eytzinger (BFS heap)
+ * order. The file is mapped and searched in place: no parsing happens
+ * at load time, and the top levels of the search tree share a few
+ * cache lines so lookups run at hashing speed. The tree starts on a
+ * 64-byte boundary, so each run of siblings a lookup may fetch from
+ * fills exactly one cache line.
+ *
+ * File layout (native byte order; a marker detects foreign files):
+ *   char magic[4] "JHIX", uint8 version, uint8 hash width, uint16 zero,
+ *   uint32 byte order marker 0x01020304, uint32 zero, uint64 count,
+ *   zero padding to 64 bytes, then (count + 1) hashes; the first one
+ *   is padding so the tree is 1-based
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+ #include <sys/mman.h>
+#endif
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashutil.h"
+#include "hashindex.h"
+
+#define HI_MAGIC "JHIX"
+#define HI_VERSION 2
+#define HI_ORDER 0x01020304U
+#define HI_LINE 64
+/* Tree nodes per cache line */
+#define HI_LINE_NODES (HI_LINE / sizeof(jodyhash_t))
+
+struct hi_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t width;
+	uint16_t zero1;
+	uint32_t order;
+	uint32_t zero2;
+	uint64_t count;
+	char pad[HI_LINE - 24];  /* Line-aligns the tree */
+};
+
+
+static int cmp_hash(const void *a, const void *b)
+{
+	jodyhash_t x = *(const jodyhash_t *)a, y = *(const jodyhash_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* Fill the tree in order from the sorted list; returns the next list index */
+static size_t eytzinger(const jodyhash_t *sorted, jodyhash_t *tree, size_t i, size_t k, size_t n)
+{
+	if (k <= n) {
+		i = eytzinger(sorted, tree, i, 2 * k, n);
+		tree[k] = sorted[i++];
+		i = eytzinger(sorted, tree, i, 2 * k + 1, n);
+	}
+	return i;
+}
+
+
+/* Parse the leading hex hash of a hash list line. Returns 1 if there is none. */
+static int parse_hash(const char *line, size_t len, jodyhash_t *hash)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < len && i < JODY_HASH_WIDTH / 4; i++) {
+		char c = line[i];
+
+		if (c >= '0' && c <= '9') v = (v << 4) | (uint64_t)(c - '0');
+		else if (c >= 'a' && c <= 'f') v = (v << 4) | (uint64_t)(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F') v = (v << 4) | (uint64_t)(c - 'A' + 10);
+		else break;
+	}
+	if (i == 0) return 1;
+	/* Too long for this width, or not followed by a separator */
+	if (i < len && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') return 1;
+	*hash = (jodyhash_t)v;
+	return 0;
+}
+
+
+/* Compile hash lists into an index file. Blank lines and lines starting
+ * with '#' are ignored; other lines must start with a hex hash. */
+extern int hashindex_build(const char *out, FILE **inputs, int ninputs)
+{
+	struct linereader lr;
+	struct hi_header hdr;
+	jodyhash_t *list = NULL, *tree = NULL, hash;
+	size_t count = 0, alloc = 0, uniq = 0;
+	uint64_t lineno;
+	char *line;
+	size_t len;
+	FILE *fp;
+	int ret;
+
+	for (int in = 0; in < ninputs; in++) {
+		if (lines_open(&lr, inputs[in]) != 0) goto error_oom;
+		lineno = 0;
+		while ((ret = lines_next(&lr, &line, &len)) > 0) {
+			lineno++;
+			if (len == 0 || line[0] == '#' || line[0] == '\r') continue;
+			if (parse_hash(line, len, &hash) != 0) {
+				fprintf(stderr, "error: no valid hash on line %llu\n", (unsigned long long)lineno);
+				lines_close(&lr);
+				goto error;
+			}
+			if (count == alloc) {
+				jodyhash_t *newlist;
+
+				alloc = alloc ? alloc * 2 : 65536;
+				newlist = (jodyhash_t *)realloc(list, alloc * sizeof(jodyhash_t));
+				if (newlist == NULL) {
+					lines_close(&lr);
+					goto error_oom;
+				}
+				list = newlist;
+			}
+			list[count++] = hash;
+		}
+		lines_close(&lr);
+		if (ret < 0) {
+			fprintf(stderr, "error reading hash list\n");
+			goto error;
+		}
+	}
+
+	if (count > 0) {
+		qsort(list, count, sizeof(jodyhash_t), cmp_hash);
+		uniq = 1;
+		for (size_t i = 1; i < count; i++) if (list[i] != list[uniq - 1]) list[uniq++] = list[i];
+	}
+	tree = (jodyhash_t *)calloc(uniq + 1, sizeof(jodyhash_t));
+	if (tree == NULL) goto error_oom;
+	eytzinger(list, tree, 0, 1, uniq);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, HI_MAGIC, 4);
+	hdr.version = HI_VERSION;
+	hdr.width = JODY_HASH_WIDTH;
+	hdr.order = HI_ORDER;
+	hdr.count = uniq;
+	fp = fopen(out, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "error: cannot create index: %s\n", out);
+		goto error;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+			|| fwrite(tree, sizeof(jodyhash_t), uniq + 1, fp) != uniq + 1) {
+		fclose(fp);
+		fprintf(stderr, "error: cannot write index: %s\n", out);
+		goto error;
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "error: cannot write index: %s\n", out);
+		goto error;
+	}
+	fprintf(stderr, "indexed %llu unique hashes (%llu read)\n", (unsigned long long)uniq, (unsigned long long)count);
+	free(list);
+	free(tree);
+	return 0;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+error:
+	free(list);
+	free(tree);
+	return 1;
+}
+
+
+/* Map an index file for lookups */
+extern int hashindex_open(struct hashindex *idx, const char *path)
+{
+	const struct hi_header *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return 1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct hi_header)) goto error_close;
+	idx->maplen = (size_t)st.st_size;
+#ifndef _WIN32
+	idx->map = mmap(NULL, idx->maplen, PROT_READ, MAP_SHARED, fd, 0);
+	if (idx->map == MAP_FAILED) goto error_close;
+	/* Lookups are random; ask for the whole index to be read ahead */
+	madvise(idx->map, idx->maplen, MADV_WILLNEED);
+#else
+	/* No mmap(); read the whole index instead */
+	idx->map = malloc(idx->maplen);
+	if (idx->map == NULL) goto error_close;
+	if (read(fd, idx->map, (unsigned int)idx->maplen) != (int)idx->maplen) {
+		free(idx->map);
+		goto error_close;
+	}
+#endif
+	close(fd);
+
+	hdr = (const struct hi_header *)idx->map;
+	if (memcmp(hdr->magic, HI_MAGIC, 4) != 0 || hdr->version != HI_VERSION
+			|| hdr->width != JODY_HASH_WIDTH || hdr->order != HI_ORDER
+			|| hdr->count >= idx->maplen
+			|| (idx->maplen - sizeof(struct hi_header)) / sizeof(jodyhash_t) != hdr->count + 1) {
+		hashindex_close(idx);
+		return 2;
+	}
+	idx->count = hdr->count;
+	idx->tree = (const jodyhash_t *)(const void *)((const char *)idx->map + sizeof(struct hi_header));
+	return 0;
+
+error_close:
+	close(fd);
+	return 1;
+}
+
+
+/* Branch-free Eytzinger descent; returns 1 if the hash is in the index */
+extern int hashindex_lookup(const struct hashindex *idx, jodyhash_t hash)
+{
+	const jodyhash_t *tree = idx->tree;
+	uint64_t n = idx->count;
+	uint64_t k = 1;
+
+	while (k <= n) {
+#if defined __GNUC__ || defined __clang__
+		/* The descendants of k that are log2(HI_LINE_NODES) levels
+		 * down are HI_LINE_NODES adjacent nodes starting at
+		 * k * HI_LINE_NODES, which is one whole cache line */
+		__builtin_prefetch(tree + k * HI_LINE_NODES);
+#endif
+		k = 2 * k + (tree[k] < hash);
+	}
+	/* Undo the right turns taken after the last left turn */
+#if defined __GNUC__ || defined __clang__
+	k >>= __builtin_ffsll((long long)~k);
+#else
+	while (k & 1) k >>= 1;
+	k >>= 1;
+#endif
+	return (k != 0 && tree[k] == hash);
+}
+
+
+extern void hashindex_close(struct hashindex *idx)
+{
+#ifndef _WIN32
+	munmap(idx->map, idx->maplen);
+#else
+	free(idx->map);
+#endif
+	idx->map = NULL;
+	idx->tree = NULL;
+	return;
+}
@@ -0,0 +1,31 @@
+/* jodyhash utility: mmap-able sorted index of known hashes (headers)
+ * See utility.c for license information */
+
+#ifndef JH_HASHINDEX_H
+#define JH_HASHINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "jody_hash.h"
+
+struct hashindex {
+	const jodyhash_t *tree;  /* 1-based Eytzinger layout; tree[0] is unused */
+	uint64_t count;
+	void *map;
+	size_t maplen;
+};
+
+extern int hashindex_build(const char *out, FILE **inputs, int ninputs);
+extern int hashindex_open(struct hashindex *idx, const char *path);
+extern int hashindex_lookup(const struct hashindex *idx, jodyhash_t hash);
+extern void hashindex_close(struct hashindex *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_HASHINDEX_H */
@@ -0,0 +1,179 @@
+/* jodyhash utility: open addressing hash set of byte strings
+ *
+ * Keys are hashed with jodyhash and probed linearly. The slot array
+ * holds only the hash and an entry pointer so probing rarely touches
+ * key memory; keys (and optional per-key data) live in an arena and
+ * are compared in full only when the hashes match.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashutil.h"
+#include "arena.h"
+#include "hashset.h"
+
+#define HS_INITIAL 1024
+/* Deleted slots keep probe chains intact until the next resize */
+#define HS_TOMBSTONE ((struct hs_entry *)(uintptr_t)1)
+
+struct hs_entry {
+	size_t len;
+	uint64_t data[];  /* valsize bytes of caller data, then the key */
+};
+
+#define ENTRY_VALUE(e) ((void *)(e)->data)
+#define ENTRY_KEY(hs,e) ((char *)(e)->data + (hs)->valsize)
+
+
+static uint64_t key_hash(const void *key, size_t len)
+{
+	jodyhash_t hash = 0;
+
+	hash_bytes(key, len, &hash);
+	return mix64((uint64_t)hash);
+}
+
+
+extern int hashset_init(struct hashset *hs, size_t valsize)
+{
+	hs->slots = (struct hs_slot *)calloc(HS_INITIAL, sizeof(struct hs_slot));
+	if (hs->slots == NULL) return 1;
+	hs->mask = HS_INITIAL - 1;
+	hs->count = 0;
+	hs->used = 0;
+	hs->valsize = (valsize + 7) & ~(size_t)7;
+	arena_init(&hs->arena);
+	return 0;
+}
+
+
+/* Find the slot holding a key, or the slot where it would be inserted */
+static struct hs_slot *find_slot(const struct hashset *hs, const void *key, size_t len, uint64_t hash)
+{
+	struct hs_slot *slot, *free_slot = NULL;
+	size_t i = (size_t)hash & hs->mask;
+
+	while (1) {
+		slot = &hs->slots[i];
+		if (slot->entry == NULL) return (free_slot != NULL) ? free_slot : slot;
+		if (slot->entry == HS_TOMBSTONE) {
+			if (free_slot == NULL) free_slot = slot;
+		} else if (slot->hash == hash && slot->entry->len == len
+				&& !memcmp(ENTRY_KEY(hs, slot->entry), key, len)) return slot;
+		i = (i + 1) & hs->mask;
+	}
+}
+
+
+/* Double the table, dropping tombstones */
+static int grow(struct hashset *hs)
+{
+	struct hs_slot *old = hs->slots;
+	size_t oldsize = hs->mask + 1;
+	size_t newsize = (hs->count * 2 >= oldsize) ? oldsize * 2 : oldsize;
+
+	hs->slots = (struct hs_slot *)calloc(newsize, sizeof(struct hs_slot));
+	if (hs->slots == NULL) {
+		hs->slots = old;
+		return 1;
+	}
+	hs->mask = newsize - 1;
+	for (size_t i = 0; i < oldsize; i++) {
+		size_t j;
+
+		if (old[i].entry == NULL || old[i].entry == HS_TOMBSTONE) continue;
+		j = (size_t)old[i].hash & hs->mask;
+		while (hs->slots[j].entry != NULL) j = (j + 1) & hs->mask;
+		hs->slots[j] = old[i];
+	}
+	hs->used = hs->count;
+	free(old);
+	return 0;
+}
+
+
+/* Add a key if it is not present. Returns the key's data area (valsize
+ * bytes, zeroed when new) or NULL when out of memory. *inserted is set
+ * to 1 if the key was added by this call. */
+extern void *hashset_insert(struct hashset *hs, const void *key, size_t len, int *inserted)
+{
+	uint64_t hash = key_hash(key, len);
+	struct hs_slot *slot;
+	struct hs_entry *entry;
+
+	*inserted = 0;
+	slot = find_slot(hs, key, len, hash);
+	if (slot->entry != NULL && slot->entry != HS_TOMBSTONE) return ENTRY_VALUE(slot->entry);
+
+	/* Keep the load factor under 3/4 */
+	if ((hs->used + 1) * 4 > (hs->mask + 1) * 3) {
+		if (grow(hs) != 0) return NULL;
+		slot = find_slot(hs, key, len, hash);
+	}
+
+	entry = (struct hs_entry *)arena_alloc(&hs->arena, sizeof(struct hs_entry) + hs->valsize + len);
+	if (entry == NULL) return NULL;
+	entry->len = len;
+	memset(ENTRY_VALUE(entry), 0, hs->valsize);
+	memcpy(ENTRY_KEY(hs, entry), key, len);
+	if (slot->entry == NULL) hs->used++;
+	slot->hash = hash;
+	slot->entry = entry;
+	hs->count++;
+	*inserted = 1;
+	return ENTRY_VALUE(entry);
+}
+
+
+/* Returns the key's data area or NULL if the key is not present */
+extern void *hashset_find(const struct hashset *hs, const void *key, size_t len)
+{
+	struct hs_slot *slot = find_slot(hs, key, len, key_hash(key, len));
+
+	if (slot->entry == NULL || slot->entry == HS_TOMBSTONE) return NULL;
+	return ENTRY_VALUE(slot->entry);
+}
+
+
+/* Remove a key; its arena memory is reclaimed only by hashset_free() */
+extern int hashset_delete(struct hashset *hs, const void *key, size_t len)
+{
+	struct hs_slot *slot = find_slot(hs, key, len, key_hash(key, len));
+
+	if (slot->entry == NULL || slot->entry == HS_TOMBSTONE) return 1;
+	slot->entry = HS_TOMBSTONE;
+	hs->count--;
+	return 0;
+}
+
+
+/* Iterate over all keys; start with *iter = 0. Returns the data area
+ * of the next key or NULL when finished. */
+extern void *hashset_next(const struct hashset *hs, size_t *iter, const char **key, size_t *len)
+{
+	for (; *iter <= hs->mask; (*iter)++) {
+		struct hs_entry *entry = hs->slots[*iter].entry;
+
+		if (entry == NULL || entry == HS_TOMBSTONE) continue;
+		(*iter)++;
+		*key = ENTRY_KEY(hs, entry);
+		*len = entry->len;
+		return ENTRY_VALUE(entry);
+	}
+	return NULL;
+}
+
+
+extern void hashset_free(struct hashset *hs)
+{
+	free(hs->slots);
+	hs->slots = NULL;
+	arena_free(&hs->arena);
+	return;
+}
@@ -0,0 +1,42 @@
+/* jodyhash utility: open addressing hash set of byte strings (headers)
+ * See utility.c for license information */
+
+#ifndef JH_HASHSET_H
+#define JH_HASHSET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+struct hs_entry;
+
+struct hs_slot {
+	uint64_t hash;
+	struct hs_entry *entry;
+};
+
+struct hashset {
+	struct hs_slot *slots;
+	size_t mask;
+	size_t count;
+	size_t used;     /* Live entries plus tombstones */
+	size_t valsize;  /* Bytes of caller data stored with each key */
+	struct arena arena;
+};
+
+extern int hashset_init(struct hashset *hs, size_t valsize);
+extern void *hashset_insert(struct hashset *hs, const void *key, size_t len, int *inserted);
+extern void *hashset_find(const struct hashset *hs, const void *key, size_t len);
+extern int hashset_delete(struct hashset *hs, const void *key, size_t len);
+extern void *hashset_next(const struct hashset *hs, size_t *iter, const char **key, size_t *len);
+extern void hashset_free(struct hashset *hs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_HASHSET_H */
@@ -0,0 +1,105 @@
+/* jodyhash utility: shared hashing and line input helpers
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashutil.h"
+
+#define LINES_BSIZE (1024 * 1024)
+#define HASH_BYTES_STACK 1024
+
+
+/* Hash an arbitrary unaligned byte string. jody_block_hash() needs an
+ * aligned buffer it can read whole words from, so the data is copied.
+ * *hash is the starting value (zero, or a seed). */
+extern int hash_bytes(const void *data, size_t len, jodyhash_t *hash)
+{
+	jodyhash_t stackbuf[HASH_BYTES_STACK / sizeof(jodyhash_t)];
+	jodyhash_t *buf = stackbuf;
+	int ret;
+
+	if (len > HASH_BYTES_STACK) {
+		buf = (jodyhash_t *)malloc(len + sizeof(jodyhash_t));
+		if (buf == NULL) return 1;
+	}
+	memcpy(buf, data, len);
+	ret = jody_block_hash(buf, hash, len);
+	if (buf != stackbuf) free(buf);
+	return ret;
+}
+
+
+extern int lines_open(struct linereader *lr, FILE *fp)
+{
+	lr->fp = fp;
+	lr->size = LINES_BSIZE;
+	lr->start = 0;
+	lr->end = 0;
+	lr->eof = 0;
+	lr->buf = (char *)malloc(lr->size);
+	if (lr->buf == NULL) return 1;
+	return 0;
+}
+
+
+/* Get the next line without its '\n'. The line points into the reader's
+ * buffer and is only valid until the next call.
+ * Returns 1 for a line, 0 at end of input, -1 on error */
+extern int lines_next(struct linereader *lr, char **line, size_t *len)
+{
+	char *nl;
+	size_t scanned = 0;
+	size_t got;
+
+	while (1) {
+		nl = (char *)memchr(lr->buf + lr->start + scanned, '\n', lr->end - lr->start - scanned);
+		if (nl != NULL) {
+			*line = lr->buf + lr->start;
+			*len = (size_t)(nl - *line);
+			lr->start += *len + 1;
+			return 1;
+		}
+		scanned = lr->end - lr->start;
+
+		if (lr->eof) {
+			/* Final line without a newline */
+			if (lr->end == lr->start) return 0;
+			*line = lr->buf + lr->start;
+			*len = lr->end - lr->start;
+			lr->start = lr->end;
+			return 1;
+		}
+
+		/* Make room: slide the partial line down, grow for huge lines */
+		if (lr->start > 0) {
+			memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+			lr->end -= lr->start;
+			lr->start = 0;
+		}
+		if (lr->end == lr->size) {
+			char *newbuf = (char *)realloc(lr->buf, lr->size * 2);
+			if (newbuf == NULL) return -1;
+			lr->buf = newbuf;
+			lr->size *= 2;
+		}
+		got = fread(lr->buf + lr->end, 1, lr->size - lr->end, lr->fp);
+		if (ferror(lr->fp)) return -1;
+		if (got == 0 || feof(lr->fp)) lr->eof = 1;
+		lr->end += got;
+	}
+}
+
+
+extern void lines_close(struct linereader *lr)
+{
+	free(lr->buf);
+	lr->buf = NULL;
+	return;
+}
@@ -0,0 +1,57 @@
+/* jodyhash utility: shared hashing and line input helpers (headers)
+ * See utility.c for license information */
+
+#ifndef JH_HASHUTIL_H
+#define JH_HASHUTIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "jody_hash.h"
+
+/* Streaming line reader; lines may be any length and contain NULs */
+struct linereader {
+	FILE *fp;
+	char *buf;
+	size_t size;
+	size_t start;
+	size_t end;
+	int eof;
+};
+
+extern int lines_open(struct linereader *lr, FILE *fp);
+extern int lines_next(struct linereader *lr, char **line, size_t *len);
+extern void lines_close(struct linereader *lr);
+
+extern int hash_bytes(const void *data, size_t len, jodyhash_t *hash);
+
+/* Nanosecond timestamps from struct stat: ST_NSEC(st, m) for mtime,
+ * ST_NSEC(st, c) for ctime */
+#if defined __APPLE__
+#define ST_NSEC(st,t) ((int64_t)(st).st_##t##timespec.tv_sec * 1000000000 + (st).st_##t##timespec.tv_nsec)
+#elif defined _WIN32
+#define ST_NSEC(st,t) ((int64_t)(st).st_##t##time * 1000000000)
+#else
+#define ST_NSEC(st,t) ((int64_t)(st).st_##t##tim.tv_sec * 1000000000 + (st).st_##t##tim.tv_nsec)
+#endif
+
+/* Spread the bits of a jodyhash across 64 bits (MurmurHash3 finalizer)
+ * for use as a table index or estimator input */
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_HASHUTIL_H */
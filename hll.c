@@ -0,0 +1,161 @@
+/* jodyhash utility: HyperLogLog distinct count estimator
+ *
+ * Estimates how many distinct hashes were seen using 2^p one-byte
+ * registers regardless of input size. Sketches can be saved and merged
+ * later; merging takes the maximum of each register, and a sketch with
+ * a higher precision can be folded into a lower precision one.
+ *
+ * Sketch file format (all single bytes, then the registers):
+ *   "JHLL" magic, format version, precision, hash width, reserved,
+ *   2^precision register bytes
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "jody_hash.h"
+#include "hashutil.h"
+#include "hll.h"
+
+#define HLL_MAGIC "JHLL"
+#define HLL_VERSION 1
+#define HLL_HEADER 8
+
+
+extern int hll_init(struct hll *h, int p)
+{
+	if (p < HLL_MIN_PRECISION || p > HLL_MAX_PRECISION) return 1;
+	h->p = p;
+	h->reg = (uint8_t *)calloc((size_t)1 << p, 1);
+	if (h->reg == NULL) return 1;
+	return 0;
+}
+
+
+/* Position of the first set bit in the bits left after the index (1-based) */
+static uint8_t hll_rank(uint64_t w, int bits)
+{
+	uint8_t rank = 1;
+
+	while (rank <= bits && !(w & 0x8000000000000000ULL)) {
+		w <<= 1;
+		rank++;
+	}
+	return rank;
+}
+
+
+extern void hll_add(struct hll *h, jodyhash_t hash)
+{
+	/* jodyhash bits are not uniform enough to use directly */
+	uint64_t x = mix64((uint64_t)hash);
+	size_t idx = (size_t)(x >> (64 - h->p));
+	uint8_t rank = hll_rank(x << h->p, 64 - h->p);
+
+	if (rank > h->reg[idx]) h->reg[idx] = rank;
+	return;
+}
+
+
+extern double hll_estimate(const struct hll *h)
+{
+	const size_t m = (size_t)1 << h->p;
+	double alpha, sum = 0.0, est;
+	size_t zeros = 0;
+
+	switch (h->p) {
+		case 4: alpha = 0.673; break;
+		case 5: alpha = 0.697; break;
+		case 6: alpha = 0.709; break;
+		default: alpha = 0.7213 / (1.0 + 1.079 / (double)m); break;
+	}
+	for (size_t i = 0; i < m; i++) {
+		sum += ldexp(1.0, -(int)h->reg[i]);
+		if (h->reg[i] == 0) zeros++;
+	}
+	est = alpha * (double)m * (double)m / sum;
+	/* Small range correction: linear counting is better here */
+	if (est <= 2.5 * (double)m && zeros > 0)
+		est = (double)m * log((double)m / (double)zeros);
+	return est;
+}
+
+
+extern int hll_save(const struct hll *h, const char *path)
+{
+	uint8_t hdr[HLL_HEADER];
+	FILE *fp;
+	int ret = 0;
+
+	memcpy(hdr, HLL_MAGIC, 4);
+	hdr[4] = HLL_VERSION;
+	hdr[5] = (uint8_t)h->p;
+	hdr[6] = JODY_HASH_WIDTH;
+	hdr[7] = 0;
+	fp = fopen(path, "wb");
+	if (fp == NULL) return 1;
+	if (fwrite(hdr, 1, HLL_HEADER, fp) != HLL_HEADER) ret = 1;
+	if (fwrite(h->reg, 1, (size_t)1 << h->p, fp) != (size_t)1 << h->p) ret = 1;
+	if (fclose(fp) != 0) ret = 1;
+	return ret;
+}
+
+
+/* Merge a saved sketch into h. Returns 0 on success, 1 on I/O errors,
+ * 2 for a bad or incompatible sketch */
+extern int hll_load(struct hll *h, const char *path)
+{
+	uint8_t hdr[HLL_HEADER];
+	uint8_t *reg;
+	size_t m;
+	int shift;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) return 1;
+	if (fread(hdr, 1, HLL_HEADER, fp) != HLL_HEADER) goto error_bad;
+	if (memcmp(hdr, HLL_MAGIC, 4) != 0 || hdr[4] != HLL_VERSION || hdr[6] != JODY_HASH_WIDTH) goto error_bad;
+	if (hdr[5] < HLL_MIN_PRECISION || hdr[5] > HLL_MAX_PRECISION || hdr[5] < h->p) goto error_bad;
+
+	m = (size_t)1 << hdr[5];
+	reg = (uint8_t *)malloc(m);
+	if (reg == NULL) goto error_bad;
+	if (fread(reg, 1, m, fp) != m) {
+		free(reg);
+		goto error_bad;
+	}
+	fclose(fp);
+
+	/* Fold higher precision registers: the dropped index bits become
+	 * the leading bits of the rank */
+	shift = hdr[5] - h->p;
+	for (size_t i = 0; i < m; i++) {
+		size_t idx = i >> shift;
+		size_t low = i & (((size_t)1 << shift) - 1);
+		uint8_t rank;
+
+		if (reg[i] == 0) continue;
+		if (low != 0) rank = hll_rank((uint64_t)low << (64 - shift), shift);
+		else rank = (uint8_t)(reg[i] + shift);
+		if (rank > h->reg[idx]) h->reg[idx] = rank;
+	}
+	free(reg);
+	return 0;
+
+error_bad:
+	fclose(fp);
+	return 2;
+}
+
+
+extern void hll_free(struct hll *h)
+{
+	free(h->reg);
+	h->reg = NULL;
+	return;
+}
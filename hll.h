@@ -0,0 +1,34 @@
+/* jodyhash utility: HyperLogLog distinct count estimator (headers)
+ * See utility.c for license information */
+
+#ifndef JH_HLL_H
+#define JH_HLL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "jody_hash.h"
+
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+#define HLL_DEFAULT_PRECISION 14
+
+struct hll {
+	int p;
+	uint8_t *reg;
+};
+
+extern int hll_init(struct hll *h, int p);
+extern void hll_add(struct hll *h, jodyhash_t hash);
+extern double hll_estimate(const struct hll *h);
+extern int hll_save(const struct hll *h, const char *path);
+extern int hll_load(struct hll *h, const char *path);
+extern void hll_free(struct hll *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_HLL_H */
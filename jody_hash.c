@@ -19,6 +19,73 @@
 
 static const jodyhash_t jh_s_constant = JH_ROR2(JODY_HASH_CONSTANT);
 
+/* Code path used for blocks of 32 bytes or more; detected on first use.
+ * Threaded callers must call jody_hash_set_backend() before starting
+ * threads so that first use can't happen in two threads at once. */
+static int active_backend = -1;
+
+
+/* Pick the fastest code path this build and CPU support */
+static int detect_backend(void)
+{
+#ifndef NO_AVX2
+#if defined __GNUC__ || defined __clang__
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+#endif /* __GNUC__ || __clang__ */
+		return JODY_HASH_AVX2;
+#endif /* NO_AVX2 */
+#ifndef NO_SSE2
+#if defined __GNUC__ || defined __clang__
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse2"))
+#endif /* __GNUC__ || __clang__ */
+		return JODY_HASH_SSE2;
+#endif /* NO_SSE2 */
+	return JODY_HASH_SCALAR;
+}
+
+
+/* Force a specific code path (for testing and benchmarking) or go back
+ * to automatic selection with JODY_HASH_AUTO. All code paths produce
+ * identical hashes. Returns nonzero if the build or CPU can't run it. */
+extern int jody_hash_set_backend(int backend)
+{
+	int best = detect_backend();
+
+	switch (backend) {
+		case JODY_HASH_AUTO: active_backend = best; return 0;
+		case JODY_HASH_SCALAR: break;
+#ifndef NO_SSE2
+		case JODY_HASH_SSE2:
+#if defined __GNUC__ || defined __clang__
+			__builtin_cpu_init ();
+			if (!__builtin_cpu_supports ("sse2")) return 1;
+#endif
+			break;
+#endif /* NO_SSE2 */
+		case JODY_HASH_AVX2:
+			if (best != JODY_HASH_AVX2) return 1;
+			break;
+		default: return 1;
+	}
+	active_backend = backend;
+	return 0;
+}
+
+
+/* Name of the code path in use for large blocks */
+extern const char *jody_hash_backend_name(void)
+{
+	if (active_backend < 0) active_backend = detect_backend();
+	switch (active_backend) {
+		case JODY_HASH_AVX2: return "avx2";
+		case JODY_HASH_SSE2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+
 /* Hash a block of arbitrary size; must be divisible by sizeof(jodyhash_t)
  * The first block should pass an initial hash of zero.
  * All blocks after the first should pass hash as the value
@@ -34,42 +101,26 @@ extern int jody_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t coun
 	/* Don't bother trying to hash a zero-length block */
 	if (unlikely(count == 0)) return 0;
 
+	if (unlikely(active_backend < 0)) active_backend = detect_backend();
+
+	length = count / sizeof(jodyhash_t);
+	if (count >= 32) {
+		switch (active_backend) {
 #ifndef NO_AVX2
-#if defined __GNUC__ || defined __clang__
-	__builtin_cpu_init ();
-	if (__builtin_cpu_supports ("avx2")) {
-#endif /* __GNUC__ || __clang__ */
-		if (count >= 32) {
-			if (jody_block_hash_avx2(&data, hash, count, &length) != 0) return 1;
-			goto skip_sse2;
-		} else length = count / sizeof(jodyhash_t);
-#if defined __GNUC__ || defined __clang__
-	} else length = count / sizeof(jodyhash_t);
+			case JODY_HASH_AVX2:
+				if (jody_block_hash_avx2(&data, hash, count, &length) != 0) return 1;
+				break;
 #endif
-#else
-	length = count / sizeof(jodyhash_t);
-#endif /* NO_AVX2 */
-
-
 #ifndef NO_SSE2
-#if defined __GNUC__ || defined __clang__
-	__builtin_cpu_init ();
-	if (__builtin_cpu_supports ("sse2")) {
-#endif /* __GNUC__ || __clang__ */
-		if (count >= 32) {
-			if (jody_block_hash_sse2(&data, hash, count, &length) != 0) return 1;
-		}
-		else length = count / sizeof(jodyhash_t);
-#if defined __GNUC__ || defined __clang__
-	} else length = count / sizeof(jodyhash_t);
+			case JODY_HASH_SSE2:
+				if (jody_block_hash_sse2(&data, hash, count, &length) != 0) return 1;
+				break;
 #endif
-#else
-	length = count / sizeof(jodyhash_t);
-#endif /* NO_SSE2 */
+			default:
+				break;
+		}
+	}
 
-#ifndef NO_AVX2
-skip_sse2:
-#endif
 	/* Hash everything (normal) or remaining small tails (SSE2) */
 	for (; length > 0; length--) {
 		element = *data;
@@ -100,6 +151,37 @@ skip_sse2:
 }
 
 
+/* Advance a hash as if 'count' zero bytes were passed to jody_block_hash().
+ * No data is loaded; every zero word mixes in the same two constants, so
+ * this is much cheaper than hashing a buffer full of zeroes. The same
+ * block divisibility rules as jody_block_hash() apply. */
+extern int jody_zero_hash(jodyhash_t *hash, const size_t count)
+{
+	const jodyhash_t element = JODY_HASH_CONSTANT;
+	const jodyhash_t element2 = jh_s_constant;
+	jodyhash_t h = *hash;
+	size_t length = count / sizeof(jodyhash_t);
+
+	for (; length > 0; length--) {
+		h += element;
+		h ^= element2;
+		h = JH_ROL2(h);
+		h += element;
+	}
+
+	/* A zero tail is still a zero element after masking */
+	if (count & (sizeof(jodyhash_t) - 1)) {
+		h += element;
+		h ^= element2;
+		h = JH_ROL2(h);
+		h += element2;
+	}
+
+	*hash = h;
+	return 0;
+}
+
+
 #define ROLLBSIZE 4096
 #define ROLLBSIZEW (ROLLBSIZE / sizeof(jodyhash_t))
 extern int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count)
@@ -107,7 +189,6 @@ extern int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const siz
 	jodyhash_t rollhash;
 	size_t blocks = (count & ~((uint64_t)ROLLBSIZE - 1)) / ROLLBSIZE;
 	for (unsigned int i = 0; i < blocks; i++) {
-fprintf(stderr, "rolling([%u] %p, %016" PRIx64 ", %d)\n", i, (void *)data, *hash, ROLLBSIZE);
 		rollhash = 0;
 		if (jody_block_hash(data, &rollhash, ROLLBSIZE)) return 1;
 		*hash ^= rollhash;
@@ -116,7 +197,6 @@ fprintf(stderr, "rolling([%u] %p, %016" PRIx64 ", %d)\n", i, (void *)data, *hash
 	/* Hash the last block */
 	blocks = count - (blocks * ROLLBSIZE);
 	if (blocks > 0) {
-fprintf(stderr, "rolltail(%p, %016" PRIx64 ", %d)\n", (void *)data, *hash, ROLLBSIZE);
 		rollhash = 0;
 		if (jody_block_hash(data, &rollhash, blocks)) return 1;
 		*hash ^= rollhash;
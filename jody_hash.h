@@ -92,8 +92,17 @@ static const jodyhash_t tail_mask[] = {
 #define JH_ROR2(a) (jodyhash_t)(a >> JH_SHIFT2 | (a << ((sizeof(jodyhash_t) * 8) - JH_SHIFT2)))
 
 
+/* Code paths for jody_hash_set_backend() */
+#define JODY_HASH_AUTO   0
+#define JODY_HASH_SCALAR 1
+#define JODY_HASH_SSE2   2
+#define JODY_HASH_AVX2   3
+
 extern int jody_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
 extern int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
+extern int jody_zero_hash(jodyhash_t *hash, const size_t count);
+extern int jody_hash_set_backend(int backend);
+extern const char *jody_hash_backend_name(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,431 @@
+/* jodyhash utility: minimal perfect hash tables for static key sets
+ *
+ * Keys are split into buckets of about MPH_LAMBDA keys by their seeded
+ * jodyhash. Buckets are placed largest first: each one gets the first
+ * 16-bit "pilot" that moves all of its keys to free positions in a
+ * table slightly larger than the key count (CHD/PTHash style). The few
+ * positions past the end are then remapped into the holes left below
+ * it, so keys map one-to-one onto 0 to n - 1. A lookup reads one pilot,
+ * then one fingerprint to tell members from non-members (plus one remap
+ * entry for the few keys past the end); no probing is ever needed. The
+ * pilot array is about half a byte per key, so it only stays in cache
+ * for smaller tables; at 10M keys it is 5 MB and a lookup usually costs
+ * two cache misses.
+ *
+ * File layout (native byte order; a marker detects foreign files):
+ *   char magic[4] "JHPH", uint8 version, uint8 hash width, uint16 zero,
+ *   uint32 byte order marker 0x01020304, uint32 zero,
+ *   uint64 n, m, nbuckets, seed, salt,
+ *   uint16 pilot[nbuckets], uint32 remap[m - n], uint64 fingerprint[n]
+ *   with each array padded to a multiple of 8 bytes
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+ #include <sys/mman.h>
+#endif
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashutil.h"
+#include "mphf.h"
+
+#define MPH_MAGIC "JHPH"
+#define MPH_VERSION 1
+#define MPH_ORDER 0x01020304U
+/* Average keys per bucket; more means a smaller table but slower builds */
+#define MPH_LAMBDA 4
+#define MPH_MAX_PILOT 65535
+/* Fresh salts to try when some bucket fits nowhere */
+#define MPH_MAX_SALTS 16
+#define GOLDEN 0x9e3779b97f4a7c15ULL
+
+struct mph_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t width;
+	uint16_t zero1;
+	uint32_t order;
+	uint32_t zero2;
+	uint64_t n;
+	uint64_t m;
+	uint64_t nbuckets;
+	uint64_t seed;
+	uint64_t salt;
+};
+
+#define PAD8(x) (((x) + 7) & ~(size_t)7)
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+
+/* Map a 64-bit hash onto 0 to range - 1 without a division */
+static inline uint64_t reduce(uint64_t x, uint64_t range)
+{
+#ifdef __SIZEOF_INT128__
+	return (uint64_t)(((uint128)x * range) >> 64);
+#else
+	return x % range;
+#endif
+}
+
+
+/* 64 bits of seeded jodyhash; narrower widths are hashed several times
+ * with different seeds so large key sets don't collide */
+static int key_hash(const void *key, size_t len, uint64_t seed, uint64_t *hash)
+{
+#if JODY_HASH_WIDTH == 64
+	jodyhash_t h = (jodyhash_t)seed;
+
+	if (hash_bytes(key, len, &h) != 0) return 1;
+	*hash = h;
+#else
+	*hash = 0;
+	for (unsigned int i = 0; i < 64 / JODY_HASH_WIDTH; i++) {
+		jodyhash_t h = (jodyhash_t)(seed + (uint64_t)i * GOLDEN);
+
+		if (hash_bytes(key, len, &h) != 0) return 1;
+		*hash = (*hash << JODY_HASH_WIDTH) | h;
+	}
+#endif
+	return 0;
+}
+
+
+static inline uint64_t bucket_of(uint64_t hash, uint64_t nbuckets)
+{
+	return reduce(mix64(hash), nbuckets);
+}
+
+
+static inline uint64_t key_part(uint64_t hash, uint64_t salt)
+{
+	return mix64(hash ^ ((salt + 1) * GOLDEN));
+}
+
+
+static inline uint64_t pilot_part(uint16_t pilot)
+{
+	return mix64((uint64_t)pilot + 1);
+}
+
+
+static inline uint64_t position(uint64_t hash, uint64_t salt, uint16_t pilot, uint64_t m)
+{
+	return reduce(key_part(hash, salt) ^ pilot_part(pilot), m);
+}
+
+
+/* Give every bucket a pilot; returns 1 if some bucket can't be placed */
+static int place(const uint64_t *keys, const uint32_t *start, const uint32_t *order,
+		uint64_t nbuckets, uint64_t m, uint64_t salt, uint16_t *pilot, uint64_t *taken)
+{
+	uint64_t part[256], pos[256];
+
+	memset(taken, 0, ((m + 63) / 64) * sizeof(uint64_t));
+	memset(pilot, 0, nbuckets * sizeof(uint16_t));
+	for (uint64_t i = 0; i < nbuckets; i++) {
+		uint32_t b = order[i];
+		uint32_t size = start[b + 1] - start[b];
+		uint32_t p;
+
+		if (size == 0) break;
+		for (uint32_t k = 0; k < size; k++) part[k] = key_part(keys[start[b] + k], salt);
+		for (p = 0; p <= MPH_MAX_PILOT; p++) {
+			uint64_t pp = pilot_part((uint16_t)p);
+			uint32_t k;
+
+			for (k = 0; k < size; k++) {
+				uint64_t x = reduce(part[k] ^ pp, m);
+
+				if (taken[x / 64] & (1ULL << (x % 64))) break;
+				for (uint32_t j = 0; j < k; j++) if (pos[j] == x) goto next_pilot;
+				pos[k] = x;
+			}
+			if (k == size) break;
+next_pilot:
+			continue;
+		}
+		if (p > MPH_MAX_PILOT) return 1;
+		pilot[b] = (uint16_t)p;
+		for (uint32_t k = 0; k < size; k++) taken[pos[k] / 64] |= 1ULL << (pos[k] % 64);
+	}
+	return 0;
+}
+
+
+/* Build a table from key files, one key per line. Empty lines are
+ * skipped and a trailing '\r' is not part of the key. */
+extern int mphf_build(const char *out, FILE **inputs, int ninputs, uint64_t seed)
+{
+	struct linereader lr;
+	struct mph_header hdr;
+	uint64_t *hashes = NULL, *keys = NULL, *taken = NULL, *fingerprint = NULL;
+	uint32_t *start = NULL, *order = NULL, *remap = NULL, *sizes = NULL;
+	uint16_t *pilot = NULL;
+	uint64_t n = 0, alloc = 0, m, nbuckets, salt, maxsize = 0;
+	static const uint64_t zero = 0;
+	char *line;
+	size_t len;
+	FILE *fp;
+	int ret;
+
+	for (int in = 0; in < ninputs; in++) {
+		if (lines_open(&lr, inputs[in]) != 0) goto error_oom;
+		while ((ret = lines_next(&lr, &line, &len)) > 0) {
+			if (len > 0 && line[len - 1] == '\r') len--;
+			if (len == 0) continue;
+			if (n == alloc) {
+				uint64_t *newhashes;
+
+				alloc = alloc ? alloc * 2 : 65536;
+				newhashes = (uint64_t *)realloc(hashes, alloc * sizeof(uint64_t));
+				if (newhashes == NULL) {
+					lines_close(&lr);
+					goto error_oom;
+				}
+				hashes = newhashes;
+			}
+			if (key_hash(line, len, seed, &hashes[n++]) != 0) {
+				lines_close(&lr);
+				goto error_oom;
+			}
+		}
+		lines_close(&lr);
+		if (ret < 0) {
+			fprintf(stderr, "error reading key list\n");
+			goto error;
+		}
+	}
+	if (n >= UINT32_MAX) {
+		fprintf(stderr, "error: too many keys (max %u)\n", UINT32_MAX - 1);
+		goto error;
+	}
+
+	nbuckets = n / MPH_LAMBDA + 1;
+	/* About 1.5% spare positions keep the last pilot searches short */
+	m = n + (n >> 6) + 1;
+
+	/* Group keys by bucket (counting sort) */
+	start = (uint32_t *)calloc(nbuckets + 1, sizeof(uint32_t));
+	keys = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+	if (start == NULL || keys == NULL) goto error_oom;
+	for (uint64_t i = 0; i < n; i++) start[bucket_of(hashes[i], nbuckets) + 1]++;
+	for (uint64_t b = 0; b < nbuckets; b++) {
+		if (start[b + 1] > maxsize) maxsize = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	if (maxsize > 256) {
+		fprintf(stderr, "error: too many keys share a hash; are there duplicate keys?\n");
+		goto error;
+	}
+	{
+		uint32_t *fill = (uint32_t *)malloc(nbuckets * sizeof(uint32_t));
+
+		if (fill == NULL) goto error_oom;
+		memcpy(fill, start, nbuckets * sizeof(uint32_t));
+		for (uint64_t i = 0; i < n; i++) keys[fill[bucket_of(hashes[i], nbuckets)]++] = hashes[i];
+		free(fill);
+	}
+	free(hashes);
+	hashes = NULL;
+
+	/* Equal hashes can never be separated */
+	for (uint64_t b = 0; b < nbuckets; b++)
+		for (uint32_t i = start[b]; i < start[b + 1]; i++)
+			for (uint32_t j = start[b]; j < i; j++)
+				if (keys[i] == keys[j]) {
+					fprintf(stderr, "error: duplicate key in key list\n");
+					goto error;
+				}
+
+	/* Place the largest buckets first (counting sort by size) */
+	sizes = (uint32_t *)calloc(maxsize + 2, sizeof(uint32_t));
+	order = (uint32_t *)malloc(nbuckets * sizeof(uint32_t));
+	if (sizes == NULL || order == NULL) goto error_oom;
+	for (uint64_t b = 0; b < nbuckets; b++) sizes[maxsize - (start[b + 1] - start[b]) + 1]++;
+	for (uint64_t s = 0; s <= maxsize; s++) sizes[s + 1] += sizes[s];
+	for (uint64_t b = 0; b < nbuckets; b++) order[sizes[maxsize - (start[b + 1] - start[b])]++] = (uint32_t)b;
+
+	pilot = (uint16_t *)malloc(PAD8(nbuckets * sizeof(uint16_t)));
+	taken = (uint64_t *)malloc(((m + 63) / 64) * sizeof(uint64_t));
+	if (pilot == NULL || taken == NULL) goto error_oom;
+	for (salt = 0; salt < MPH_MAX_SALTS; salt++)
+		if (place(keys, start, order, nbuckets, m, salt, pilot, taken) == 0) break;
+	if (salt == MPH_MAX_SALTS) {
+		fprintf(stderr, "error: no perfect hash found; try another seed\n");
+		goto error;
+	}
+
+	/* Move positions past n into the free slots below n */
+	remap = (uint32_t *)calloc(m - n + 1, sizeof(uint32_t));
+	fingerprint = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+	if (remap == NULL || fingerprint == NULL) goto error_oom;
+	{
+		uint64_t hole = 0;
+
+		for (uint64_t x = n; x < m; x++) {
+			if (!(taken[x / 64] & (1ULL << (x % 64)))) continue;
+			while (taken[hole / 64] & (1ULL << (hole % 64))) hole++;
+			remap[x - n] = (uint32_t)hole++;
+		}
+	}
+	for (uint64_t b = 0; b < nbuckets; b++)
+		for (uint32_t i = start[b]; i < start[b + 1]; i++) {
+			uint64_t x = position(keys[i], salt, pilot[b], m);
+
+			if (x >= n) x = remap[x - n];
+			fingerprint[x] = keys[i];
+		}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MPH_MAGIC, 4);
+	hdr.version = MPH_VERSION;
+	hdr.width = JODY_HASH_WIDTH;
+	hdr.order = MPH_ORDER;
+	hdr.n = n;
+	hdr.m = m;
+	hdr.nbuckets = nbuckets;
+	hdr.seed = seed;
+	hdr.salt = salt;
+	fp = fopen(out, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "error: cannot create table: %s\n", out);
+		goto error;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+			|| fwrite(pilot, sizeof(uint16_t), nbuckets, fp) != nbuckets
+			|| fwrite(&zero, 1, PAD8(nbuckets * 2) - nbuckets * 2, fp) != PAD8(nbuckets * 2) - nbuckets * 2
+			|| fwrite(remap, sizeof(uint32_t), m - n, fp) != m - n
+			|| fwrite(&zero, 1, PAD8((m - n) * 4) - (m - n) * 4, fp) != PAD8((m - n) * 4) - (m - n) * 4
+			|| fwrite(fingerprint, sizeof(uint64_t), n, fp) != n) {
+		fclose(fp);
+		fprintf(stderr, "error: cannot write table: %s\n", out);
+		goto error;
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "error: cannot write table: %s\n", out);
+		goto error;
+	}
+	fprintf(stderr, "built table for %llu keys (%.2f bits/key without fingerprints)\n",
+			(unsigned long long)n, n ? (double)(nbuckets * 16 + (m - n) * 32) / (double)n : 0.0);
+	ret = 0;
+	goto done;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+error:
+	ret = 1;
+done:
+	free(hashes);
+	free(keys);
+	free(start);
+	free(sizes);
+	free(order);
+	free(pilot);
+	free(taken);
+	free(remap);
+	free(fingerprint);
+	return ret;
+}
+
+
+/* Map a table file for lookups */
+extern int mphf_open(struct mphf *t, const char *path)
+{
+	const struct mph_header *hdr;
+	const char *p;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return 1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct mph_header)) goto error_close;
+	t->maplen = (size_t)st.st_size;
+#ifndef _WIN32
+	t->map = mmap(NULL, t->maplen, PROT_READ, MAP_SHARED, fd, 0);
+	if (t->map == MAP_FAILED) goto error_close;
+#else
+	/* No mmap(); read the whole table instead */
+	t->map = malloc(t->maplen);
+	if (t->map == NULL) goto error_close;
+	if (read(fd, t->map, (unsigned int)t->maplen) != (int)t->maplen) {
+		free(t->map);
+		goto error_close;
+	}
+#endif
+	close(fd);
+
+	hdr = (const struct mph_header *)t->map;
+	if (memcmp(hdr->magic, MPH_MAGIC, 4) != 0 || hdr->version != MPH_VERSION
+			|| hdr->width != JODY_HASH_WIDTH || hdr->order != MPH_ORDER
+			|| hdr->m <= hdr->n || hdr->nbuckets == 0 || hdr->n >= UINT32_MAX
+			/* Bound each array by the file size first so the sizes
+			 * below can't overflow and wrap around to match */
+			|| hdr->nbuckets > t->maplen / 2 || hdr->m - hdr->n > t->maplen / 4
+			|| hdr->n > t->maplen / 8
+			|| t->maplen != sizeof(struct mph_header) + PAD8(hdr->nbuckets * 2)
+				+ PAD8((hdr->m - hdr->n) * 4) + hdr->n * 8) {
+		mphf_close(t);
+		return 2;
+	}
+	t->n = hdr->n;
+	t->m = hdr->m;
+	t->nbuckets = hdr->nbuckets;
+	t->seed = hdr->seed;
+	t->salt = hdr->salt;
+	p = (const char *)t->map + sizeof(struct mph_header);
+	t->pilot = (const uint16_t *)(const void *)p;
+	p += PAD8(t->nbuckets * 2);
+	t->remap = (const uint32_t *)(const void *)p;
+	p += PAD8((t->m - t->n) * 4);
+	t->fingerprint = (const uint64_t *)(const void *)p;
+	/* Lookups index the fingerprints with remapped positions unchecked */
+	if (t->n > 0) for (uint64_t i = 0; i < t->m - t->n; i++) {
+		if (t->remap[i] >= t->n) {
+			mphf_close(t);
+			return 2;
+		}
+	}
+	return 0;
+
+error_close:
+	close(fd);
+	return 1;
+}
+
+
+/* Returns the key's position (0 to n - 1), or -1 if it isn't in the table */
+extern int64_t mphf_lookup(const struct mphf *t, const void *key, size_t len)
+{
+	uint64_t hash, x;
+
+	if (t->n == 0 || key_hash(key, len, t->seed, &hash) != 0) return -1;
+	x = position(hash, t->salt, t->pilot[bucket_of(hash, t->nbuckets)], t->m);
+	if (unlikely(x >= t->n)) x = t->remap[x - t->n];
+	if (t->fingerprint[x] != hash) return -1;
+	return (int64_t)x;
+}
+
+
+extern void mphf_close(struct mphf *t)
+{
+#ifndef _WIN32
+	munmap(t->map, t->maplen);
+#else
+	free(t->map);
+#endif
+	t->map = NULL;
+	return;
+}
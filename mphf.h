@@ -0,0 +1,36 @@
+/* jodyhash utility: minimal perfect hash tables for static key sets (headers)
+ * See utility.c for license information */
+
+#ifndef JH_MPHF_H
+#define JH_MPHF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct mphf {
+	uint64_t n;         /* Keys; lookups return 0 to n - 1 */
+	uint64_t m;         /* Positions before remapping */
+	uint64_t nbuckets;
+	uint64_t seed;      /* jodyhash starting value for key hashes */
+	uint64_t salt;      /* Position salt that let every bucket fit */
+	const uint16_t *pilot;
+	const uint32_t *remap;       /* Positions n to m - 1 moved below n */
+	const uint64_t *fingerprint; /* Key hash per position, for misses */
+	void *map;
+	size_t maplen;
+};
+
+extern int mphf_build(const char *out, FILE **inputs, int ninputs, uint64_t seed);
+extern int mphf_open(struct mphf *t, const char *path);
+extern int64_t mphf_lookup(const struct mphf *t, const void *key, size_t len);
+extern void mphf_close(struct mphf *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_MPHF_H */
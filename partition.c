@@ -0,0 +1,258 @@
+/* jodyhash utility: hash partitioning of lines or fixed-size records
+ *
+ * Each line (or record) is hashed and written to one of N outputs in a
+ * single pass. The output is chosen with jump consistent hashing
+ * (Lamping and Veach, 2014), so going from N to N+1 outputs moves only
+ * about 1/(N+1) of the keys and the rest stay where they were. For
+ * lines, the hash is the one -l prints for the line, so anything
+ * downstream can work out which shard a key landed in.
+ *
+ * Every output gets its own large buffer that is written out only when
+ * full; the buffer size shrinks as the number of outputs grows so the
+ * total stays bounded.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "hashutil.h"
+#include "partition.h"
+#include "stats.h"
+
+/* Per-output buffer size: PART_TOTAL split across the outputs, clamped */
+#define PART_TOTAL  (64 * 1024 * 1024)
+#define PART_MINBUF (64 * 1024)
+#define PART_MAXBUF (1024 * 1024)
+/* Records read per fread() call in record mode */
+#define PART_RECS_MIN (256 * 1024)
+
+struct shard {
+	FILE *fp;
+	char *name;
+	char *buf;
+	size_t used;
+};
+
+static struct shard *shards;
+static int nshards;
+static size_t shardbuf;
+static size_t recsize;
+
+
+/* Jump consistent hash: a bucket in [0, buckets) for key */
+static int jump_hash(uint64_t key, int buckets)
+{
+	int64_t b = -1, j = 0;
+
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (int64_t)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+	return (int)b;
+}
+
+
+static int shard_flush(struct shard *s)
+{
+	if (s->used == 0) return 0;
+	if (fwrite(s->buf, 1, s->used, s->fp) != s->used) {
+		fprintf(stderr, "error: cannot write: %s\n", s->name);
+		return 1;
+	}
+	s->used = 0;
+	return 0;
+}
+
+
+/* Append data plus an optional newline to a shard's buffer */
+static int shard_write(struct shard *s, const char *data, size_t len, int newline)
+{
+	size_t need = len + (newline ? 1 : 0);
+
+	if (unlikely(s->used + need > shardbuf)) {
+		if (shard_flush(s) != 0) return 1;
+		/* Too big to buffer at all */
+		if (need > shardbuf) {
+			if (fwrite(data, 1, len, s->fp) != len
+					|| (newline && fputc('\n', s->fp) == EOF)) {
+				fprintf(stderr, "error: cannot write: %s\n", s->name);
+				return 1;
+			}
+			return 0;
+		}
+	}
+	memcpy(s->buf + s->used, data, len);
+	s->used += len;
+	if (newline) s->buf[s->used++] = '\n';
+	return 0;
+}
+
+
+/* Set up count outputs. target is "fd:K" for already open descriptors
+ * K to K+count-1, or a file name where "%d" is replaced by the output
+ * number (".N" is appended if there is no "%d"). record is the record
+ * size in bytes, or 0 for lines. Returns 0, 1 on errors, 2 when out of
+ * memory */
+extern int partition_init(int count, const char *target, size_t record)
+{
+	const char *pct = strstr(target, "%d");
+	size_t namelen = strlen(target) + 16;
+	int fdbase = -1;
+
+	if (!strncmp(target, "fd:", 3)) {
+		char *end;
+		long fd = strtol(target + 3, &end, 10);
+
+		if (*end != '\0' || fd < 0 || fd > INT_MAX - count) {
+			fprintf(stderr, "error: bad descriptor: %s\n", target);
+			return 1;
+		}
+		fdbase = (int)fd;
+	}
+
+	shardbuf = PART_TOTAL / (size_t)count;
+	if (shardbuf < PART_MINBUF) shardbuf = PART_MINBUF;
+	if (shardbuf > PART_MAXBUF) shardbuf = PART_MAXBUF;
+	recsize = record;
+	shards = (struct shard *)calloc((size_t)count, sizeof(struct shard));
+	if (shards == NULL) return 2;
+
+	for (nshards = 0; nshards < count; nshards++) {
+		struct shard *s = shards + nshards;
+
+		s->name = (char *)malloc(namelen);
+		s->buf = (char *)malloc(shardbuf);
+		if (s->name == NULL || s->buf == NULL) {
+			free(s->name);
+			free(s->buf);
+			return 2;
+		}
+		if (fdbase >= 0) {
+			snprintf(s->name, namelen, "fd %d", fdbase + nshards);
+			s->fp = fdopen(fdbase + nshards, "wb");
+		} else {
+			if (pct != NULL) snprintf(s->name, namelen, "%.*s%d%s",
+					(int)(pct - target), target, nshards, pct + 2);
+			else snprintf(s->name, namelen, "%s.%d", target, nshards);
+			s->fp = fopen(s->name, "wb");
+		}
+		if (s->fp == NULL) {
+			fprintf(stderr, "error: cannot open output: %s\n", s->name);
+			free(s->name);
+			free(s->buf);
+			return 1;
+		}
+		/* Writes are already batched in s->buf */
+		setvbuf(s->fp, NULL, _IONBF, 0);
+	}
+	return 0;
+}
+
+
+static int partition_lines(FILE *fp)
+{
+	struct linereader lr;
+	char *line;
+	size_t len;
+	int ret;
+
+	if (lines_open(&lr, fp) != 0) return 2;
+	while ((ret = lines_next(&lr, &line, &len)) > 0) {
+		jodyhash_t hash = 0;
+		size_t hlen = len;
+
+		STATS_BYTES(len + 1);
+		if (hlen > 0 && line[hlen - 1] == '\r') hlen--;
+		if (hash_bytes(line, hlen, &hash) != 0) {
+			lines_close(&lr);
+			return 2;
+		}
+		if (shard_write(shards + jump_hash((uint64_t)hash, nshards), line, len, 1) != 0) {
+			lines_close(&lr);
+			return 3;
+		}
+	}
+	lines_close(&lr);
+	return (ret < 0) ? 1 : 0;
+}
+
+
+static int partition_records(FILE *fp)
+{
+	/* Whole records per read, at least PART_RECS_MIN bytes */
+	size_t per = (recsize < PART_RECS_MIN) ? PART_RECS_MIN / recsize : 1;
+	/* Aligned records can be hashed in place */
+	int aligned = (recsize % sizeof(jodyhash_t) == 0);
+	jodyhash_t *buf;
+	size_t got;
+	int ret = 0;
+
+	buf = (jodyhash_t *)malloc(per * recsize + sizeof(jodyhash_t));
+	if (buf == NULL) return 2;
+	while ((got = fread(buf, 1, per * recsize, fp)) > 0) {
+		STATS_BYTES(got);
+		for (size_t off = 0; off < got; off += recsize) {
+			char *rec = (char *)buf + off;
+			size_t len = (got - off < recsize) ? got - off : recsize;
+			jodyhash_t hash = 0;
+			int err;
+
+			/* A short final record is hashed and passed on as it is */
+			if (aligned && len == recsize) err = jody_block_hash((jodyhash_t *)(void *)rec, &hash, len);
+			else err = hash_bytes(rec, len, &hash);
+			if (err != 0) {
+				ret = 2;
+				goto done;
+			}
+			if (shard_write(shards + jump_hash((uint64_t)hash, nshards), rec, len, 0) != 0) {
+				ret = 3;
+				goto done;
+			}
+		}
+		if (got < per * recsize) break;
+	}
+	if (ferror(fp)) ret = 1;
+done:
+	free(buf);
+	return ret;
+}
+
+
+/* Returns 0 on success, 1 on read error, 2 when out of memory, 3 when
+ * an output can't be written */
+extern int partition_stream(FILE *fp)
+{
+	if (recsize > 0) return partition_records(fp);
+	return partition_lines(fp);
+}
+
+
+/* Flush and close every output. Returns 0, or 1 on write errors */
+extern int partition_done(void)
+{
+	int ret = 0;
+
+	for (int i = 0; i < nshards; i++) {
+		struct shard *s = shards + i;
+
+		if (shard_flush(s) != 0) ret = 1;
+		if (fclose(s->fp) != 0) {
+			fprintf(stderr, "error: cannot close: %s\n", s->name);
+			ret = 1;
+		}
+		free(s->name);
+		free(s->buf);
+	}
+	free(shards);
+	shards = NULL;
+	nshards = 0;
+	return ret;
+}
@@ -0,0 +1,25 @@
+/* jodyhash utility: hash partitioning of lines or records (headers)
+ * See utility.c for license information */
+
+#ifndef JH_PARTITION_H
+#define JH_PARTITION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Upper limit on the number of outputs */
+#define PARTITION_MAX 65536
+
+extern int partition_init(int count, const char *target, size_t record);
+extern int partition_stream(FILE *fp);
+extern int partition_done(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_PARTITION_H */
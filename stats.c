@@ -0,0 +1,216 @@
+/* jodyhash utility: runtime statistics and hardware counters
+ *
+ * Tracks bytes, files, wall time, and how that time splits between
+ * waiting for input and hashing. On Linux, perf_event_open() hardware
+ * counters (cycles, instructions, cache and branch misses) are read at
+ * every phase change and charged to the phase that just ended. Counters
+ * are optional: if the kernel refuses them only timings are reported.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "jody_hash.h"
+#include "stats.h"
+
+#ifdef __linux__
+ #include <unistd.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <linux/perf_event.h>
+ #define USE_PERF_CODE
+#endif
+
+#define NUM_COUNTERS 4
+static const char *counter_names[NUM_COUNTERS] = {
+	"cycles", "instructions", "cache_misses", "branch_misses"
+};
+static const char *phase_names[STATS_PHASES] = { "other", "io", "hash" };
+
+int stats_enabled = 0;
+
+static int phase = STATS_OTHER;
+static double phase_start;
+static double start_time;
+static double phase_time[STATS_PHASES];
+static uint64_t bytes;
+static uint64_t files;
+
+static int have_counters = 0;
+static int counters_kernel = 0;
+static uint64_t last_count[NUM_COUNTERS];
+static uint64_t phase_count[STATS_PHASES][NUM_COUNTERS];
+
+#ifdef USE_PERF_CODE
+static int perf_fd[NUM_COUNTERS];
+static const uint64_t perf_config[NUM_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+#endif
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+#ifdef USE_PERF_CODE
+/* Open all counters as one group so they are scheduled together */
+static int perf_open(int exclude_kernel)
+{
+	struct perf_event_attr pe;
+
+	for (int c = 0; c < NUM_COUNTERS; c++) {
+		memset(&pe, 0, sizeof(struct perf_event_attr));
+		pe.type = PERF_TYPE_HARDWARE;
+		pe.size = sizeof(struct perf_event_attr);
+		pe.config = perf_config[c];
+		pe.disabled = (c == 0);
+		if (exclude_kernel) pe.exclude_kernel = 1;
+		pe.exclude_hv = 1;
+		pe.read_format = PERF_FORMAT_GROUP;
+		perf_fd[c] = (int)syscall(__NR_perf_event_open, &pe, 0, -1, (c == 0) ? -1 : perf_fd[0], 0);
+		if (perf_fd[c] == -1) {
+			for (int d = 0; d < c; d++) close(perf_fd[d]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Read the current group totals */
+static int perf_read(uint64_t *counts)
+{
+	uint64_t buf[1 + NUM_COUNTERS];
+
+	if (read(perf_fd[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) return 1;
+	for (int c = 0; c < NUM_COUNTERS; c++) counts[c] = buf[1 + c];
+	return 0;
+}
+#endif /* USE_PERF_CODE */
+
+
+extern void stats_init(void)
+{
+	stats_enabled = 1;
+	start_time = now();
+	phase_start = start_time;
+#ifdef USE_PERF_CODE
+	/* Counting kernel time shows the real cost of I/O, but is often not allowed */
+	if (perf_open(0) == 0) counters_kernel = 1;
+	else if (perf_open(1) != 0) return;
+	ioctl(perf_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(perf_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	if (perf_read(last_count) == 0) have_counters = 1;
+#endif
+	return;
+}
+
+
+/* Charge everything since the last change to the old phase */
+extern void stats_phase(int newphase)
+{
+	double t;
+
+	if (newphase == phase) return;
+	t = now();
+	phase_time[phase] += t - phase_start;
+	phase_start = t;
+#ifdef USE_PERF_CODE
+	if (have_counters) {
+		uint64_t counts[NUM_COUNTERS];
+
+		if (perf_read(counts) == 0) {
+			for (int c = 0; c < NUM_COUNTERS; c++) {
+				phase_count[phase][c] += counts[c] - last_count[c];
+				last_count[c] = counts[c];
+			}
+		}
+	}
+#endif
+	phase = newphase;
+	return;
+}
+
+
+extern void stats_bytes(uint64_t count)
+{
+	bytes += count;
+	return;
+}
+
+
+extern void stats_file(void)
+{
+	files++;
+	return;
+}
+
+
+extern void stats_report(FILE *out, int json)
+{
+	double wall, gbs;
+
+	stats_phase(STATS_OTHER);
+	wall = now() - start_time;
+	gbs = (wall > 0.0) ? (double)bytes / wall / 1e9 : 0.0;
+
+	if (json) {
+		fprintf(out, "{\"files\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"wall_seconds\":%.6f,"
+				"\"io_seconds\":%.6f,\"hash_seconds\":%.6f,\"gb_per_sec\":%.4f,"
+				"\"backend\":\"%s\",\"width\":%d",
+				files, bytes, wall, phase_time[STATS_IO], phase_time[STATS_HASH], gbs,
+				jody_hash_backend_name(), JODY_HASH_WIDTH);
+		if (have_counters) {
+			fprintf(out, ",\"counters_include_kernel\":%s,\"phases\":{", counters_kernel ? "true" : "false");
+			for (int p = STATS_IO; p < STATS_PHASES; p++) {
+				fprintf(out, "%s\"%s\":{", (p == STATS_IO) ? "" : ",", phase_names[p]);
+				for (int c = 0; c < NUM_COUNTERS; c++)
+					fprintf(out, "\"%s\":%" PRIu64 ",", counter_names[c], phase_count[p][c]);
+				fprintf(out, "\"cycles_per_byte\":%.4f}",
+						bytes ? (double)phase_count[p][0] / (double)bytes : 0.0);
+			}
+			fprintf(out, "}");
+		}
+		fprintf(out, "}\n");
+		return;
+	}
+
+	fprintf(out, "files: %" PRIu64 "  bytes: %" PRIu64 "  wall: %.6f s  throughput: %.3f GB/s\n",
+			files, bytes, wall, gbs);
+	fprintf(out, "backend: %s (%d bit width)\n", jody_hash_backend_name(), JODY_HASH_WIDTH);
+	fprintf(out, "I/O wait: %.6f s (%.1f%%)  hashing: %.6f s (%.1f%%)\n",
+			phase_time[STATS_IO], wall > 0.0 ? phase_time[STATS_IO] * 100.0 / wall : 0.0,
+			phase_time[STATS_HASH], wall > 0.0 ? phase_time[STATS_HASH] * 100.0 / wall : 0.0);
+	if (!have_counters) {
+		fprintf(out, "hardware counters: unavailable\n");
+		return;
+	}
+	fprintf(out, "hardware counters (%s):\n", counters_kernel ? "user+kernel" : "user only");
+	fprintf(out, "  %-5s %14s %14s %6s %11s %14s %14s\n", "phase", "cycles", "instructions",
+			"IPC", "cycles/byte", "cache misses", "branch misses");
+	for (int p = STATS_IO; p < STATS_PHASES; p++) {
+		const uint64_t *pc = phase_count[p];
+
+		fprintf(out, "  %-5s %14" PRIu64 " %14" PRIu64 " %6.2f %11.3f %14" PRIu64 " %14" PRIu64 "\n",
+				phase_names[p], pc[0], pc[1],
+				pc[0] ? (double)pc[1] / (double)pc[0] : 0.0,
+				bytes ? (double)pc[0] / (double)bytes : 0.0,
+				pc[2], pc[3]);
+	}
+	return;
+}
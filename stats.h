@@ -0,0 +1,38 @@
+/* jodyhash utility: runtime statistics and hardware counters (headers)
+ * See utility.c for license information */
+
+#ifndef JH_STATS_H
+#define JH_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "likely_unlikely.h"
+
+/* Where time is being spent */
+#define STATS_OTHER 0
+#define STATS_IO    1
+#define STATS_HASH  2
+#define STATS_PHASES 3
+
+extern int stats_enabled;
+
+/* Cheap no-ops unless --stats was given */
+#define STATS_PHASE(p) do { if (unlikely(stats_enabled)) stats_phase(p); } while (0)
+#define STATS_BYTES(n) do { if (unlikely(stats_enabled)) stats_bytes(n); } while (0)
+#define STATS_FILE() do { if (unlikely(stats_enabled)) stats_file(); } while (0)
+
+extern void stats_init(void);
+extern void stats_phase(int phase);
+extern void stats_bytes(uint64_t count);
+extern void stats_file(void);
+extern void stats_report(FILE *out, int json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_STATS_H */
@@ -0,0 +1,339 @@
+/* jodyhash utility: streaming tar member hashing
+ *
+ * Parses a ustar/pax/GNU tar stream and prints "hash  member-path" for
+ * every regular file in a single pass. Member data is hashed straight
+ * out of the read buffer; nothing is written to disk.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include "likely_unlikely.h"
+#include "jody_hash.h"
+#include "tar.h"
+#include "stats.h"
+
+#define TAR_BLOCK 512
+/* Old GNU sparse headers: nonzero if sparse map blocks follow */
+#define TAR_GNU_ISEXTENDED 482
+#define TAR_GNU_EXT_ISEXTENDED 504  /* Same flag in each map block */
+/* Refuse absurd pax/long name records instead of allocating them */
+#define TAR_MAX_META (16 * 1024 * 1024)
+
+/* ustar header layout (POSIX.1-1988 plus GNU/pax extensions) */
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+/* Attributes carried over from pax 'x' and GNU 'L' records to the next member */
+struct tar_next {
+	char *path;
+	uint64_t size;
+	int have_size;
+};
+
+
+/* Read exactly 'len' bytes or fail */
+static int read_full(FILE *fp, void *buf, size_t len)
+{
+	if (fread(buf, 1, len, fp) != len) return 1;
+	return 0;
+}
+
+
+/* Discard 'len' bytes from a possibly unseekable stream */
+static int skip_bytes(FILE *fp, uint64_t len, jodyhash_t *buf, size_t bufsize)
+{
+	size_t chunk;
+
+	while (len > 0) {
+		chunk = (len > bufsize) ? bufsize : (size_t)len;
+		if (read_full(fp, buf, chunk) != 0) return 1;
+		len -= chunk;
+	}
+	return 0;
+}
+
+
+/* Bytes of padding after 'size' bytes of member data */
+static uint64_t tar_padding(uint64_t size)
+{
+	return (TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK;
+}
+
+
+/* Parse an octal or GNU base-256 numeric field */
+static int parse_number(const char *field, size_t len, uint64_t *val)
+{
+	uint64_t v = 0;
+	size_t i = 0;
+
+	/* GNU base-256: high bit of the first byte set, big-endian binary follows */
+	if ((unsigned char)field[0] & 0x80U) {
+		v = (unsigned char)field[0] & 0x7fU;
+		for (i = 1; i < len; i++) {
+			if (v > (UINT64_MAX >> 8)) return 1;
+			v = (v << 8) | (unsigned char)field[i];
+		}
+		*val = v;
+		return 0;
+	}
+
+	while (i < len && (field[i] == ' ' || field[i] == '\0')) i++;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+		if (v > (UINT64_MAX >> 3)) return 1;
+		v = (v << 3) | (uint64_t)(field[i] - '0');
+	}
+	if (i < len && field[i] != ' ' && field[i] != '\0') return 1;
+	*val = v;
+	return 0;
+}
+
+
+/* Check the header checksum (chksum field counted as spaces) */
+static int header_valid(const struct tar_header *hdr)
+{
+	const unsigned char *p = (const unsigned char *)hdr;
+	uint64_t want;
+	unsigned int sum = 0;
+
+	if (parse_number(hdr->chksum, sizeof(hdr->chksum), &want) != 0) return 0;
+	for (size_t i = 0; i < TAR_BLOCK; i++) {
+		if (i >= offsetof(struct tar_header, chksum) && i < offsetof(struct tar_header, typeflag)) sum += ' ';
+		else sum += p[i];
+	}
+	return (uint64_t)sum == want;
+}
+
+
+static int header_is_zero(const struct tar_header *hdr)
+{
+	const char *p = (const char *)hdr;
+
+	for (size_t i = 0; i < TAR_BLOCK; i++) if (p[i] != '\0') return 0;
+	return 1;
+}
+
+
+/* Read a pax/GNU metadata record body into a NUL-terminated buffer */
+static char *read_meta(FILE *fp, uint64_t size)
+{
+	char *meta;
+
+	if (size > TAR_MAX_META) return NULL;
+	meta = (char *)malloc((size_t)size + 1);
+	if (meta == NULL) return NULL;
+	if (read_full(fp, meta, (size_t)size) != 0) {
+		free(meta);
+		return NULL;
+	}
+	meta[size] = '\0';
+	return meta;
+}
+
+
+/* Apply "LEN key=value\n" pax records that we care about */
+static int parse_pax(char *meta, uint64_t size, struct tar_next *next)
+{
+	char *p = meta, *end = meta + size;
+
+	while (p < end) {
+		char *rec = p, *key, *val, *eol;
+		unsigned long long len = strtoull(p, &key, 10);
+
+		if (key == p || *key != ' ' || len == 0 || len > (unsigned long long)(end - rec)) return 1;
+		key++;
+		eol = rec + len - 1;
+		if (*eol != '\n') return 1;
+		*eol = '\0';
+		val = strchr(key, '=');
+		if (val == NULL) return 1;
+		*val++ = '\0';
+		if (!strcmp(key, "path")) {
+			free(next->path);
+			next->path = strdup(val);
+			if (next->path == NULL) return 1;
+		} else if (!strcmp(key, "size")) {
+			char *num_end;
+
+			/* strtoull() would take signs, spaces, and trailing junk */
+			if (*val < '0' || *val > '9') return 1;
+			errno = 0;
+			next->size = strtoull(val, &num_end, 10);
+			if (errno != 0 || *num_end != '\0') return 1;
+			next->have_size = 1;
+		}
+		p = rec + len;
+	}
+	return 0;
+}
+
+
+/* Hash 'size' bytes of member data */
+static int hash_member(FILE *fp, uint64_t size, jodyhash_t *hash, jodyhash_t *buf, size_t bufsize)
+{
+	size_t chunk;
+
+	*hash = 0;
+	while (size > 0) {
+		chunk = (size > bufsize) ? bufsize : (size_t)size;
+		STATS_PHASE(STATS_IO);
+		if (read_full(fp, buf, chunk) != 0) return 1;
+		STATS_PHASE(STATS_HASH);
+		if (jody_block_hash(buf, hash, chunk) != 0) return 2;
+		STATS_BYTES(chunk);
+		size -= chunk;
+	}
+	STATS_PHASE(STATS_OTHER);
+	return 0;
+}
+
+
+#if JODY_HASH_WIDTH == 64
+#define TAR_PRINT(h,n) printf("%016" PRIx64 "  %s\n", h, n)
+#endif
+#if JODY_HASH_WIDTH == 32
+#define TAR_PRINT(h,n) printf("%08" PRIx32 "  %s\n", h, n)
+#endif
+#if JODY_HASH_WIDTH == 16
+#define TAR_PRINT(h,n) printf("%04" PRIx16 "  %s\n", h, n)
+#endif
+
+/* Member path from pax/GNU records or the header itself */
+static const char *member_path(const struct tar_header *hdr, const struct tar_next *next,
+		char *name, size_t namesize)
+{
+	if (next->path != NULL) return next->path;
+	/* POSIX ustar splits long paths into prefix/name; old GNU headers
+	 * ("ustar  ") use that space for other things */
+	if (!memcmp(hdr->magic, "ustar", 6) && hdr->prefix[0] != '\0')
+		snprintf(name, namesize, "%.*s/%.*s",
+				(int)sizeof(hdr->prefix), hdr->prefix,
+				(int)sizeof(hdr->name), hdr->name);
+	else snprintf(name, namesize, "%.*s", (int)sizeof(hdr->name), hdr->name);
+	return name;
+}
+
+
+/* Hash every regular file in a tar stream; bufsize must be a multiple
+ * of sizeof(jodyhash_t) and at least TAR_BLOCK bytes */
+extern int tar_hash_stream(FILE *fp, jodyhash_t *buf, size_t bufsize)
+{
+	struct tar_header hdr;
+	struct tar_next next = { NULL, 0, 0 };
+	char name[sizeof(hdr.prefix) + sizeof(hdr.name) + 2];
+	const char *path;
+	uint64_t size;
+	jodyhash_t hash;
+	char *meta;
+	int ret = 0;
+
+	while (1) {
+		size_t got = fread(&hdr, 1, TAR_BLOCK, fp);
+
+		/* Some writers omit the end-of-archive blocks, but a partial
+		 * header means the archive was cut short */
+		if (got == 0 && !ferror(fp)) break;
+		if (got != TAR_BLOCK) goto error_read;
+		if (header_is_zero(&hdr)) break;
+		if (!header_valid(&hdr)) goto error_header;
+		if (parse_number(hdr.size, sizeof(hdr.size), &size) != 0) goto error_header;
+
+		switch (hdr.typeflag) {
+			/* pax extended header for the next member */
+			case 'x':
+				if ((meta = read_meta(fp, size)) == NULL) goto error_header;
+				if (parse_pax(meta, size, &next) != 0) {
+					free(meta);
+					goto error_header;
+				}
+				free(meta);
+				if (skip_bytes(fp, tar_padding(size), buf, bufsize) != 0) goto error_read;
+				continue;
+
+			/* GNU long name for the next member */
+			case 'L':
+				if ((meta = read_meta(fp, size)) == NULL) goto error_header;
+				free(next.path);
+				next.path = meta;
+				if (skip_bytes(fp, tar_padding(size), buf, bufsize) != 0) goto error_read;
+				continue;
+
+			/* Regular files */
+			case '0':
+			case '\0':
+			case '7':
+				if (next.have_size) size = next.size;
+				path = member_path(&hdr, &next, name, sizeof(name));
+				switch (hash_member(fp, size, &hash, buf, bufsize)) {
+					case 0: break;
+					case 2: goto error_hash;
+					default: goto error_read;
+				}
+				TAR_PRINT(hash, path);
+				break;
+
+			/* Old GNU sparse files: the data is stored without its holes,
+			 * so no meaningful file hash can be printed */
+			case 'S':
+				fprintf(stderr, "warning: skipping GNU sparse member: %s\n",
+						member_path(&hdr, &next, name, sizeof(name)));
+				/* More sparse maps follow while the "isextended" byte is set */
+				for (int ext = ((const char *)&hdr)[TAR_GNU_ISEXTENDED]; ext != 0;
+						ext = ((const char *)buf)[TAR_GNU_EXT_ISEXTENDED])
+					if (read_full(fp, buf, TAR_BLOCK) != 0) goto error_read;
+				if (skip_bytes(fp, size, buf, bufsize) != 0) goto error_read;
+				break;
+
+			/* Directories, links, devices, global pax headers, etc. */
+			default:
+				if (next.have_size) size = next.size;
+				if (skip_bytes(fp, size, buf, bufsize) != 0) goto error_read;
+				break;
+		}
+
+		if (skip_bytes(fp, tar_padding(size), buf, bufsize) != 0) goto error_read;
+		free(next.path);
+		next.path = NULL;
+		next.have_size = 0;
+	}
+	goto done;
+
+error_read:
+	fprintf(stderr, "error: truncated or unreadable tar stream\n");
+	ret = 1;
+	goto done;
+error_header:
+	fprintf(stderr, "error: bad tar header\n");
+	ret = 1;
+	goto done;
+error_hash:
+	fprintf(stderr, "error hashing tar member\n");
+	ret = 1;
+done:
+	free(next.path);
+	return ret;
+}
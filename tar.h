@@ -0,0 +1,20 @@
+/* jodyhash utility: streaming tar member hashing (headers)
+ * See utility.c for license information */
+
+#ifndef JH_TAR_H
+#define JH_TAR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "jody_hash.h"
+
+extern int tar_hash_stream(FILE *fp, jodyhash_t *buf, size_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_TAR_H */
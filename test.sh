@@ -26,4 +26,159 @@ ERR=0
 if [ "$HASH1" != "$GOOD1" ]; then echo "Hash FAILED: $TF1"; ERR=1; else echo "Hash PASSED: $TF1"; fi
 if [ "$HASH2" != "$GOOD2" ]; then echo "Hash FAILED: $TF2"; ERR=2; else echo "Hash PASSED: $TF2"; fi
 
+# Regression tests for the other modes; data is generated in a scratch dir
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/jodyhash-test.XXXXXX") || exit 123
+trap 'rm -rf "$TMP"' EXIT
+seq 1 200000 > "$TMP/lines"
+
+# check NAME GOT EXPECTED
+check () {
+	if [ "$2" = "$3" ]; then echo "PASSED: $1"; else echo "FAILED: $1"; ERR=3; fi
+}
+
+# -M gives the same hashes as separate runs; shared stdout is labeled
+$JODYHASH -M hash="$TMP/m.hash",block="$TMP/m.block",roll="$TMP/m.roll" "$TMP/lines"
+check "-M hash" "$(cat "$TMP/m.hash")" "$($JODYHASH "$TMP/lines")"
+check "-M block" "$(cat "$TMP/m.block")" "$($JODYHASH -B "$TMP/lines")"
+check "-M roll" "$(cat "$TMP/m.roll")" "$($JODYHASH -r "$TMP/lines")"
+check "-B -r labels" "$($JODYHASH -B -r "$TMP/lines" | cut -d' ' -f1 | sort -u | tr '\n' ' ')" "block roll "
+$JODYHASH -M prefix:16777216T "$TMP/lines" > /dev/null 2>&1
+check "-M prefix size overflow" "$?" "1"
+
+# Holes in sparse files hash the same as the zeros read through a pipe
+printf 'start' > "$TMP/sparse"
+truncate -s 3M "$TMP/sparse" && printf 'middle' >> "$TMP/sparse"
+truncate -s 8M "$TMP/sparse"
+check "sparse file" "$($JODYHASH "$TMP/sparse")" "$(cat "$TMP/sparse" | $JODYHASH)"
+check "sparse file -B" "$($JODYHASH -B "$TMP/sparse")" "$(cat "$TMP/sparse" | $JODYHASH -B)"
+
+# -t member hashes match hashing the files themselves
+mkdir "$TMP/tar" && cp "$TMP/lines" "$TMP/tar/lines" && printf 'short\n' > "$TMP/tar/short"
+(cd "$TMP" && tar cf t.tar tar/lines tar/short)
+check "-t members" "$($JODYHASH -t "$TMP/t.tar")" \
+	"$(for f in lines short; do echo "$($JODYHASH "$TMP/tar/$f")  tar/$f"; done)"
+head -c 300 "$TMP/t.tar" > "$TMP/cut.tar"
+$JODYHASH -t "$TMP/cut.tar" > /dev/null 2>&1
+check "-t truncated header fails" "$?" "1"
+head -c 700 "$TMP/t.tar" > "$TMP/cut.tar"
+$JODYHASH -t "$TMP/cut.tar" > /dev/null 2>&1
+check "-t truncated member data fails" "$?" "1"
+
+# --stats leaves the hashes alone and reports on stderr
+check "--stats -l output" "$($JODYHASH --stats -l "$TMP/lines" 2> "$TMP/stats.out")" "$($JODYHASH -l "$TMP/lines")"
+check "--stats summary" "$(grep -c -e '^files: 1  bytes: ' -e '^I/O wait: ' "$TMP/stats.out")" "2"
+check "--stats=json" "$($JODYHASH --stats=json "$TMP/lines" 2>&1 > /dev/null | grep -c '^{"files":1,')" "1"
+
+# -u prints each distinct line once, in first-seen order
+check "-u order" "$(printf 'b\na\nb\nc\na\n\nc\n' | $JODYHASH -u | tr '\n' ' ')" "b a c  "
+check "-u large" "$(cat "$TMP/lines" "$TMP/lines" | $JODYHASH -u | $JODYHASH)" "$($JODYHASH "$TMP/lines")"
+
+# -d estimates within 3% (default precision is well under that), and
+# saved sketches merge into the estimate for the union
+# within NAME GOT EXPECTED
+within () {
+	if [ -n "$2" ] && awk "BEGIN { d = $2 - $3; if (d < 0) d = -d; exit !(d <= $3 * 0.03) }"; then
+		echo "PASSED: $1"
+	else
+		echo "FAILED: $1 ($2, expected about $3)"; ERR=3
+	fi
+}
+seq 100001 300000 > "$TMP/lines2"
+within "-d lines" "$($JODYHASH -d -l "$TMP/lines")" 200000
+$JODYHASH -d -l --sketch-save="$TMP/s1" "$TMP/lines" > /dev/null
+$JODYHASH -d -l --sketch-save="$TMP/s2" "$TMP/lines2" > /dev/null
+within "-d sketch merge" "$($JODYHASH -d --sketch-load="$TMP/s1" --sketch-load="$TMP/s2")" 300000
+within "-d sketch plus input" "$($JODYHASH -d -l --sketch-load="$TMP/s1" "$TMP/lines2")" 300000
+
+# --index-match finds exactly the indexed hashes
+head -n 100000 "$TMP/lines" | $JODYHASH -l > "$TMP/known"
+$JODYHASH --index-build="$TMP/known.jhix" "$TMP/known" 2> /dev/null
+check "index hits" "$($JODYHASH --index-match="$TMP/known.jhix" -l "$TMP/lines" | head -n 100000 | grep -c '^hit ')" "100000"
+check "index misses" "$($JODYHASH --index-match="$TMP/known.jhix" -l "$TMP/lines" | tail -n 100000 | grep -c '^miss ')" "100000"
+
+# --tree manifests compare equal to their tree and report changes
+mkdir -p "$TMP/tree/a/b" "$TMP/tree/c"
+echo 1 > "$TMP/tree/a/b/f"; echo 2 > "$TMP/tree/c/g"; echo 3 > "$TMP/tree/top"
+$JODYHASH --tree "$TMP/tree" > "$TMP/tree.man"
+check "--tree entries" "$(sed 1d "$TMP/tree.man" | cut -d' ' -f2,7 | tr '\n' ' ')" \
+	"d . d a d a/b f a/b/f d c f c/g f top "
+$JODYHASH --tree-compare "$TMP/tree.man" "$TMP/tree" > "$TMP/cmp.out"
+check "--tree-compare same" "$?:$(cat "$TMP/cmp.out")" "0:"
+echo changed > "$TMP/tree/a/b/f"; rm "$TMP/tree/top"; echo 4 > "$TMP/tree/c/h"
+$JODYHASH --tree-compare "$TMP/tree.man" "$TMP/tree" > "$TMP/cmp.out"
+check "--tree-compare changes" "$?:$(tr '\n' ' ' < "$TMP/cmp.out")" "1:M a/b/f + c/h - top "
+sed 's| c/g$| a/g|' "$TMP/tree.man" > "$TMP/bad.man"
+$JODYHASH --tree-compare "$TMP/bad.man" "$TMP/tree" > /dev/null 2>&1
+check "--tree-compare damaged manifest" "$?" "2"
+
+# --mphf-query gives every key its own position 0..N-1 and non-keys '-'
+head -n 50000 "$TMP/lines" > "$TMP/keys"
+$JODYHASH --mphf-build="$TMP/keys.jhph" "$TMP/keys" 2> /dev/null
+$JODYHASH --mphf-query="$TMP/keys.jhph" "$TMP/lines" > "$TMP/mphf.out"
+check "mphf key positions" "$(head -n 50000 "$TMP/mphf.out" | cut -d' ' -f1 | sort -n | uniq | awk 'NR - 1 != $1 { bad = 1 } END { print NR, bad + 0 }')" "50000 0"
+check "mphf non-keys" "$(tail -n 150000 "$TMP/mphf.out" | grep -c '^- ')" "150000"
+# 50000 keys: the 782 remap entries start at byte 25064 (56-byte header,
+# 12501 pilots); point them all past the end
+cp "$TMP/keys.jhph" "$TMP/bad.jhph"
+i=0; while [ $i -lt 782 ]; do printf '\377\377\377\177'; i=$((i + 1)); done \
+	| dd of="$TMP/bad.jhph" bs=1 seek=25064 conv=notrunc 2> /dev/null
+$JODYHASH --mphf-query="$TMP/bad.jhph" "$TMP/keys" > /dev/null 2>&1
+check "mphf damaged remap" "$?" "1"
+
+# --watch turns each write into one change line, batch after batch
+if [ "$(uname -s)" = "Linux" ]; then
+	mkdir "$TMP/watch"
+	$JODYHASH --watch --debounce=200 "$TMP/watch" > "$TMP/watch.out" 2> "$TMP/watch.err" &
+	WPID=$!
+	n=0
+	while ! grep -q '^watching' "$TMP/watch.err" && [ $n -lt 50 ]; do sleep 0.1; n=$((n + 1)); done
+	# The second write comes after the longest debounce delay (10 x 200 ms)
+	# and is created, then written 0.05 s later: still one change
+	echo 1 > "$TMP/watch/a"; sleep 2.5
+	{ sleep 0.05; echo 3; } > "$TMP/watch/b"; sleep 1
+	kill $WPID; wait $WPID
+	check "--watch one line per write" "$(cat "$TMP/watch.out")" \
+		"$(printf '+ %s a\n+ %s b' "$(echo 1 | $JODYHASH)" "$(echo 3 | $JODYHASH)")"
+fi
+
+# --client gets the same hashes from a --daemon as direct runs
+if [ "$(uname -s)" = "Linux" ]; then
+	$JODYHASH --daemon="$TMP/d.sock" --workers=2 2> "$TMP/daemon.err" &
+	DPID=$!
+	n=0
+	while ! grep -q '^listening' "$TMP/daemon.err" && [ $n -lt 50 ]; do sleep 0.1; n=$((n + 1)); done
+	check "--client files" "$($JODYHASH --client="$TMP/d.sock" -n "$TMP/lines" "$TMP/sparse")" \
+		"$($JODYHASH -n "$TMP/lines" "$TMP/sparse")"
+	check "--client stdin" "$($JODYHASH --client="$TMP/d.sock" - < "$TMP/lines")" "$($JODYHASH < "$TMP/lines")"
+	check "--client stdin offset" \
+		"$({ dd bs=100 count=1 of=/dev/null 2> /dev/null; $JODYHASH --client="$TMP/d.sock" -; } < "$TMP/lines")" \
+		"$(tail -c +101 "$TMP/lines" | $JODYHASH)"
+	echo first > "$TMP/rewrite"
+	$JODYHASH --client="$TMP/d.sock" "$TMP/rewrite" > /dev/null
+	echo second version > "$TMP/rewrite"
+	check "--client rewritten file" "$($JODYHASH --client="$TMP/d.sock" "$TMP/rewrite")" "$(echo second version | $JODYHASH)"
+	$JODYHASH --daemon="$TMP/d.sock" 2> /dev/null
+	check "--daemon refuses a live socket" "$?" "1"
+	kill $DPID; wait $DPID
+	check "--daemon removes its socket" "$(test -e "$TMP/d.sock" && echo left)" ""
+fi
+
+# --partition keeps every line, and going from 4 to 5 outputs only
+# moves lines into the new output
+$JODYHASH --partition=4 --partition-out="$TMP/p4.%d" "$TMP/lines"
+$JODYHASH --partition=5 --partition-out="$TMP/p5.%d" "$TMP/lines"
+sort "$TMP/lines" > "$TMP/lines.sorted"
+check "--partition union" "$(cat "$TMP"/p4.* | sort | cmp - "$TMP/lines.sorted" && echo same)" "same"
+moved=0
+for i in 0 1 2 3; do
+	sort "$TMP/p4.$i" > "$TMP/p4.sorted"
+	moved=$((moved + $(sort "$TMP/p5.$i" | comm -23 - "$TMP/p4.sorted" | wc -l)))
+done
+check "--partition stable" "$moved" "0"
+within "--partition new output share" "$(wc -l < "$TMP/p5.4")" 40000
+check "--partition records" "$($JODYHASH --partition=3 --partition-out="$TMP/r.%d" --record=7 "$TMP/lines" && cat "$TMP"/r.* | wc -c)" \
+	"$(wc -c < "$TMP/lines")"
+$JODYHASH --partition=3 --partition-out="$TMP/x.%d" --daemon="$TMP/x.sock" < /dev/null > /dev/null 2>&1
+check "--partition with --daemon refused" "$?:$(ls "$TMP" | grep -c '^x\.')" "1:0"
+
 exit $ERR
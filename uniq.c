@@ -0,0 +1,56 @@
+/* jodyhash utility: unique lines mode
+ *
+ * Prints each distinct input line once in first-seen order. Every line
+ * seen so far is kept in a jodyhash-keyed set, so memory use grows with
+ * the number of distinct lines rather than the size of the input.
+ * Duplicates across multiple input files are suppressed too.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hashutil.h"
+#include "hashset.h"
+#include "uniq.h"
+#include "stats.h"
+
+static struct hashset seen;
+
+
+extern int uniq_init(void)
+{
+	return hashset_init(&seen, 0);
+}
+
+
+/* Returns 0 on success, 1 on read error, 2 when out of memory */
+extern int uniq_stream(FILE *fp)
+{
+	struct linereader lr;
+	char *line;
+	size_t len;
+	int inserted, ret;
+
+	if (lines_open(&lr, fp) != 0) return 2;
+	while ((ret = lines_next(&lr, &line, &len)) > 0) {
+		STATS_BYTES(len + 1);
+		if (hashset_insert(&seen, line, len, &inserted) == NULL) {
+			lines_close(&lr);
+			return 2;
+		}
+		if (inserted == 0) continue;
+		fwrite(line, 1, len, stdout);
+		putchar('\n');
+	}
+	lines_close(&lr);
+	return (ret < 0) ? 1 : 0;
+}
+
+
+extern void uniq_done(void)
+{
+	hashset_free(&seen);
+	return;
+}
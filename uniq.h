@@ -0,0 +1,21 @@
+/* jodyhash utility: unique lines mode (headers)
+ * See utility.c for license information */
+
+#ifndef JH_UNIQ_H
+#define JH_UNIQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+extern int uniq_init(void);
+extern int uniq_stream(FILE *fp);
+extern void uniq_done(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_UNIQ_H */
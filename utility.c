@@ -10,25 +10,30 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "likely_unlikely.h"
 #include "jody_hash.h"
 #include "jody_hash_simd.h"
+#include "hashfile.h"
+#include "tar.h"
+#include "uniq.h"
+#include "hll.h"
+#include "stats.h"
+#include "hashindex.h"
+#include "dirtree.h"
+#include "mphf.h"
+#include "daemon.h"
+#include "watch.h"
+#include "partition.h"
+#include "hashutil.h"
 #include "version.h"
 
-/* Linux perf benchmarking*/
-#if defined(__linux__) && defined(PERFBENCHMARK)
- #define _GNU_SOURCE
- #include <sys/ioctl.h>
- #include <linux/perf_event.h>
- #include <sys/syscall.h>
- #include <sys/types.h>
- #include <errno.h>
- #define USE_PERF_CODE
-#endif
-
 /* Detect Windows and modify as needed */
 #if defined _WIN32 || defined __CYGWIN__
  #define ON_WINDOWS 1
@@ -47,20 +52,141 @@
 
 #if JODY_HASH_WIDTH == 64
 #define PRINTHASH(a) printf("%016" PRIx64,a)
+#define FPRINTHASH(f,a) fprintf(f, "%016" PRIx64,a)
 #endif
 #if JODY_HASH_WIDTH == 32
 #define PRINTHASH(a) printf("%08" PRIx32,a)
+#define FPRINTHASH(f,a) fprintf(f, "%08" PRIx32,a)
 #endif
 #if JODY_HASH_WIDTH == 16
 #define PRINTHASH(a) printf("%04" PRIx16,a)
+#define FPRINTHASH(f,a) fprintf(f, "%04" PRIx16,a)
 #endif
 
 #ifndef BSIZE
 #define BSIZE 32768
 #endif
 
+/* Name printed after each file hash */
+#define NAME_NONE   0
+#define NAME_BINARY 1  /* -b/-s md5sum binary style */
+#define NAME_PLAIN  2  /* -n */
+
+/* Kinds of output a single pass over a file can produce */
+#define OUT_HASH   0
+#define OUT_BLOCK  1
+#define OUT_ROLL   2
+#define OUT_PREFIX 3
+#define MAX_OUTPUTS 16
+
+struct output {
+	int kind;
+	int prefix;        /* Index into the hashfile prefix table */
+	char tag[32];      /* Section label when several outputs share stdout */
+	FILE *fp;
+};
+
 static int error = EXIT_SUCCESS;
 static char *progname;
+static int namemode = NAME_NONE;
+/* Line-by-line hashing: 0 = off, 1 = -l, 2 = -L */
+static int linemode = 0;
+static int tarmode = 0;
+static int uniqmode = 0;
+/* Distinct count estimation with -d */
+static int distinct = 0;
+static int precision = HLL_DEFAULT_PRECISION;
+static const char *sketch_save = NULL;
+#define MAX_SKETCHES 64
+static const char *sketch_load[MAX_SKETCHES];
+static int num_sketches = 0;
+static struct hll sketch;
+/* --stats: 0 = off, 1 = human-readable, 2 = JSON */
+static int statsmode = 0;
+/* Known-hash index building and matching */
+static const char *index_build = NULL;
+static const char *index_match = NULL;
+static struct hashindex known;
+/* Directory tree hashing: 0 = off, 1 = --tree, 2 = --tree-compare */
+#define TREE_SCAN    1
+#define TREE_COMPARE 2
+static int treemode = 0;
+static const char *tree_cache = NULL;
+/* Minimal perfect hash tables */
+static const char *mphf_build_path = NULL;
+static const char *mphf_query_path = NULL;
+static uint64_t mphf_seed = 0;
+static struct mphf table;
+/* Local hashing daemon and its client */
+static const char *daemon_socket = NULL;
+static const char *client_socket = NULL;
+static int workers = 0;
+static char **client_names;
+/* Watch mode */
+static int watchmode = 0;
+static const char *watch_manifest = NULL;
+static int debounce = 200;  /* Milliseconds */
+/* Hash partitioning into --partition outputs */
+static int partitions = 0;
+static const char *partition_out = NULL;
+static long record = 0;
+static struct output outputs[MAX_OUTPUTS];
+static int num_outputs = 0;
+static struct hashfile hf;
+
+/* Long-only options */
+#define OPT_PRECISION   256
+#define OPT_SKETCH_SAVE 257
+#define OPT_SKETCH_LOAD 258
+#define OPT_STATS       259
+#define OPT_INDEX_BUILD 260
+#define OPT_INDEX_MATCH 261
+#define OPT_TREE        262
+#define OPT_TREE_CACHE  263
+#define OPT_TREE_COMPARE 264
+#define OPT_MPHF_BUILD  265
+#define OPT_MPHF_QUERY  266
+#define OPT_MPHF_SEED   267
+#define OPT_DAEMON      268
+#define OPT_WORKERS     269
+#define OPT_CLIENT      270
+#define OPT_WATCH       271
+#define OPT_WATCH_MANIFEST 272
+#define OPT_DEBOUNCE    273
+#define OPT_PARTITION   274
+#define OPT_PARTITION_OUT 275
+#define OPT_RECORD      276
+
+static const struct option long_options[] = {
+	{ "client", required_argument, NULL, OPT_CLIENT },
+	{ "daemon", required_argument, NULL, OPT_DAEMON },
+	{ "debounce", required_argument, NULL, OPT_DEBOUNCE },
+	{ "distinct", no_argument, NULL, 'd' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "index-build", required_argument, NULL, OPT_INDEX_BUILD },
+	{ "index-match", required_argument, NULL, OPT_INDEX_MATCH },
+	{ "mphf-build", required_argument, NULL, OPT_MPHF_BUILD },
+	{ "mphf-query", required_argument, NULL, OPT_MPHF_QUERY },
+	{ "mphf-seed", required_argument, NULL, OPT_MPHF_SEED },
+	{ "multi", required_argument, NULL, 'M' },
+	{ "partition", required_argument, NULL, OPT_PARTITION },
+	{ "partition-out", required_argument, NULL, OPT_PARTITION_OUT },
+	{ "precision", required_argument, NULL, OPT_PRECISION },
+	{ "record", required_argument, NULL, OPT_RECORD },
+	{ "sketch-load", required_argument, NULL, OPT_SKETCH_LOAD },
+	{ "sketch-save", required_argument, NULL, OPT_SKETCH_SAVE },
+	{ "stats", optional_argument, NULL, OPT_STATS },
+	{ "tar", no_argument, NULL, 't' },
+	{ "tree", no_argument, NULL, OPT_TREE },
+	{ "tree-cache", required_argument, NULL, OPT_TREE_CACHE },
+	{ "tree-compare", no_argument, NULL, OPT_TREE_COMPARE },
+	{ "unique", no_argument, NULL, 'u' },
+	{ "version", no_argument, NULL, 'v' },
+	{ "watch", no_argument, NULL, OPT_WATCH },
+	{ "watch-manifest", required_argument, NULL, OPT_WATCH_MANIFEST },
+	{ "workers", required_argument, NULL, OPT_WORKERS },
+	{ NULL, 0, NULL, 0 }
+};
 
 static void usage(int detailed)
 {
@@ -77,7 +203,7 @@ static void usage(int detailed)
 #endif
 		);
 	if (detailed == 0) return;
-	fprintf(stderr, "usage: %s [-b|s|n|l|L] [file_to_hash]\n", progname);
+	fprintf(stderr, "usage: %s [-b|s|n|l|L|B|r|t|u|d] [-M outputs] [file_to_hash]\n", progname);
 	fprintf(stderr, "Specifying no name or '-' as the name reads from stdin\n");
 	fprintf(stderr, "  -b|-s  Output in md5sum binary style instead of bare hashes\n");
 	fprintf(stderr, "  -n     Output just the file name after the hash\n");
@@ -85,9 +211,372 @@ static void usage(int detailed)
 	fprintf(stderr, "  -L     Same as -l but also prints hashed text after the hash\n");
 	fprintf(stderr, "  -B     Output a hash for every 4096 byte block of the file\n");
 	fprintf(stderr, "  -r     Output a rolling 4K hash\n");
+	fprintf(stderr, "  -t     Read tar archives; print 'hash  path' for each regular file\n");
+	fprintf(stderr, "  -u     Print each distinct input line once, in first-seen order\n");
+	fprintf(stderr, "  -d     Estimate the number of distinct hashes instead of printing\n");
+	fprintf(stderr, "         them; counts lines with -l, 4K blocks with -B, else files\n");
+	fprintf(stderr, "         --precision=P   estimator precision %d-%d (default %d)\n",
+			HLL_MIN_PRECISION, HLL_MAX_PRECISION, HLL_DEFAULT_PRECISION);
+	fprintf(stderr, "         --sketch-save=FILE  save the estimator sketch for merging\n");
+	fprintf(stderr, "         --sketch-load=FILE  merge a saved sketch (repeatable)\n");
+	fprintf(stderr, "  --index-build=INDEX  Compile hash lists (e.g. -s output) into a\n");
+	fprintf(stderr, "         binary index of known hashes\n");
+	fprintf(stderr, "  --index-match=INDEX  Prefix each file (or -l/-L line) hash with\n");
+	fprintf(stderr, "         'hit' or 'miss' depending on whether INDEX contains it\n");
+	fprintf(stderr, "  --mphf-build=TABLE  Build a minimal perfect hash table from keys,\n");
+	fprintf(stderr, "         one per line; --mphf-seed=N picks another hash seed\n");
+	fprintf(stderr, "  --mphf-query=TABLE  Print each input line's table position, or '-'\n");
+	fprintf(stderr, "         if it is not a key, followed by the line\n");
+	fprintf(stderr, "  --tree DIR  Print a manifest of per-file and per-directory (Merkle)\n");
+	fprintf(stderr, "         hashes for a directory tree\n");
+	fprintf(stderr, "  --tree-compare A B  List differences between two trees; A and B\n");
+	fprintf(stderr, "         can be directories or saved manifests. Identical subtrees\n");
+	fprintf(stderr, "         are skipped. Exit status is 1 if they differ, 2 on errors\n");
+	fprintf(stderr, "         --tree-cache=MANIFEST  reuse hashes of unchanged files\n");
+	fprintf(stderr, "  --watch DIR  Hash a tree, then use inotify to re-hash only files\n");
+	fprintf(stderr, "         written after that, printing '+', 'M' and '-' change lines\n");
+	fprintf(stderr, "         --watch-manifest=FILE  keep a live manifest in FILE\n");
+	fprintf(stderr, "         --debounce=MS  wait for MS quiet milliseconds (default 200)\n");
+	fprintf(stderr, "  --daemon=SOCKET  Serve hash requests on a UNIX socket with a pool\n");
+	fprintf(stderr, "         of worker threads and a result cache; --workers=N\n");
+	fprintf(stderr, "  --client=SOCKET  Hash files through a running daemon (-s/-n work)\n");
+	fprintf(stderr, "  --partition=N  Send each line to one of N outputs chosen by jump\n");
+	fprintf(stderr, "         consistent hashing of its hash; --partition-out=OUT names\n");
+	fprintf(stderr, "         them: a file name with %%d for the number, or fd:K for open\n");
+	fprintf(stderr, "         descriptors K to K+N-1. --record=SIZE splits fixed-size\n");
+	fprintf(stderr, "         records instead of lines\n");
+	fprintf(stderr, "  --stats[=json]  Report bytes, time, I/O vs. hashing split, backend,\n");
+	fprintf(stderr, "         and hardware counters (where available) on stderr\n");
+	fprintf(stderr, "  -M list  Compute several outputs from one read of each file.\n");
+	fprintf(stderr, "         'list' is comma-separated: hash, block, roll, prefix:SIZE\n");
+	fprintf(stderr, "         Append =FILE to an item to write it to its own file;\n");
+	fprintf(stderr, "         outputs sharing stdout are labeled with the item name\n");
+	return;
+}
+
+
+/* Parse a byte count with an optional K/M/G/T (binary) suffix */
+static int parse_size(const char *str, uint64_t *size)
+{
+	char *end;
+	unsigned long long val;
+	int shift = 0;
+
+	if (*str < '0' || *str > '9') return 1;
+	errno = 0;
+	val = strtoull(str, &end, 10);
+	if (errno != 0) return 1;
+	switch (*end) {
+		case 'T': case 't': shift++; /* Fall through */
+		case 'G': case 'g': shift++; /* Fall through */
+		case 'M': case 'm': shift++; /* Fall through */
+		case 'K': case 'k': shift++; end++; break;
+		case '\0': break;
+		default: return 1;
+	}
+	if (*end != '\0' || val == 0) return 1;
+	/* Don't let a suffix wrap the value around */
+	for (; shift > 0; shift--) {
+		if (val > (UINT64_MAX >> 10)) return 1;
+		val <<= 10;
+	}
+	*size = (uint64_t)val;
+	return 0;
+}
+
+
+/* Input for -l/-L. Reading a buffer at a time lets --stats charge each
+ * read to I/O; switching phases on every line would cost more than
+ * hashing a short line. read() returns whatever is available, so lines
+ * from a pipe are still hashed as they arrive. */
+struct linebuf {
+	int fd;
+	size_t start;
+	size_t end;
+	int eof;
+	char buf[BSIZE];
+};
+
+
+/* Copy the next line into out like fgets() does: up to size - 1 bytes,
+ * stopping after a newline. Returns the length copied, 0 at the end of
+ * input, or -1 on read errors */
+static ssize_t next_line(struct linebuf *lb, char *out, size_t size)
+{
+	size_t len = 0;
+
+	while (len < size - 1) {
+		const char *nl;
+		size_t n;
+
+		if (lb->start == lb->end) {
+			ssize_t got;
+
+			if (lb->eof) break;
+			STATS_PHASE(STATS_IO);
+			got = read(lb->fd, lb->buf, sizeof(lb->buf));
+			STATS_PHASE(STATS_HASH);
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			if (got == 0) {
+				lb->eof = 1;
+				break;
+			}
+			lb->start = 0;
+			lb->end = (size_t)got;
+		}
+		n = lb->end - lb->start;
+		if (n > size - 1 - len) n = size - 1 - len;
+		nl = (const char *)memchr(lb->buf + lb->start, '\n', n);
+		if (nl != NULL) n = (size_t)(nl - (lb->buf + lb->start)) + 1;
+		memcpy(out + len, lb->buf + lb->start, n);
+		lb->start += n;
+		len += n;
+		if (nl != NULL) break;
+	}
+	out[len] = '\0';
+	return (ssize_t)len;
+}
+
+
+/* Add one output destination for a file pass */
+static int add_output(int kind, uint64_t prefix_len, const char *file)
+{
+	struct output *out;
+
+	if (num_outputs >= MAX_OUTPUTS) {
+		fprintf(stderr, "error: too many outputs (max %d)\n", MAX_OUTPUTS);
+		return 1;
+	}
+	out = &outputs[num_outputs];
+	out->kind = kind;
+	out->prefix = -1;
+	out->tag[0] = '\0';
+	out->fp = stdout;
+	/* finish_outputs() drops the label unless stdout is shared */
+	switch (kind) {
+		case OUT_HASH: hf.want |= HF_HASH; strcpy(out->tag, "hash"); break;
+		case OUT_BLOCK: hf.want |= HF_BLOCKS; strcpy(out->tag, "block"); break;
+		case OUT_ROLL: hf.want |= HF_ROLL; strcpy(out->tag, "roll"); break;
+		case OUT_PREFIX:
+			if (hf.prefixes >= HF_MAX_PREFIXES) {
+				fprintf(stderr, "error: too many prefix outputs (max %d)\n", HF_MAX_PREFIXES);
+				return 1;
+			}
+			out->prefix = hf.prefixes;
+			hf.prefix_len[hf.prefixes++] = prefix_len;
+			hf.want |= HF_PREFIX;
+			break;
+		default: return 1;
+	}
+	if (file != NULL && strcmp(file, "-") != 0) {
+		out->fp = fopen(file, "w");
+		if (out->fp == NULL) {
+			fprintf(stderr, "error: cannot open output file: %s\n", file);
+			return 1;
+		}
+	}
+	num_outputs++;
+	return 0;
+}
+
+
+/* Parse a -M output list such as "hash,block=blocks.txt,prefix:64K" */
+static int parse_outputs(char *list)
+{
+	char *item, *file;
+	uint64_t prefix_len = 0;
+	int kind;
+
+	for (item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+		file = strchr(item, '=');
+		if (file != NULL) *file++ = '\0';
+		if (!strcmp(item, "hash")) kind = OUT_HASH;
+		else if (!strcmp(item, "block") || !strcmp(item, "blocks")) kind = OUT_BLOCK;
+		else if (!strcmp(item, "roll")) kind = OUT_ROLL;
+		else if (!strncmp(item, "prefix:", 7)) {
+			kind = OUT_PREFIX;
+			if (parse_size(item + 7, &prefix_len) != 0) {
+				fprintf(stderr, "error: bad prefix size: %s\n", item + 7);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "error: unknown output type: %s\n", item);
+			return 1;
+		}
+		if (add_output(kind, prefix_len, file) != 0) return 1;
+		if (kind == OUT_PREFIX) snprintf(outputs[num_outputs - 1].tag, 32, "%s", item);
+	}
+	return 0;
+}
+
+
+/* Label outputs only when more than one of them writes to stdout */
+static void finish_outputs(void)
+{
+	int on_stdout = 0;
+
+	for (int o = 0; o < num_outputs; o++) if (outputs[o].fp == stdout) on_stdout++;
+	for (int o = 0; o < num_outputs; o++)
+		if (on_stdout < 2 || outputs[o].fp != stdout) outputs[o].tag[0] = '\0';
+	return;
+}
+
+
+/* Print each block hash to every block output as it is computed */
+static void print_block(jodyhash_t hash, void *arg)
+{
+	(void)arg;
+	if (distinct != 0) {
+		hll_add(&sketch, hash);
+		return;
+	}
+	for (int o = 0; o < num_outputs; o++) {
+		if (outputs[o].kind != OUT_BLOCK) continue;
+		if (outputs[o].tag[0] != '\0') fprintf(outputs[o].fp, "%s ", outputs[o].tag);
+		FPRINTHASH(outputs[o].fp, hash);
+		fputc('\n', outputs[o].fp);
+	}
 	return;
 }
 
+
+/* Look up every line of a stream in the --mphf-query table.
+ * Returns 0, or 1 on read errors */
+static int mphf_query_stream(FILE *fp)
+{
+	struct linereader lr;
+	char *line;
+	size_t len;
+	int ret;
+
+	if (lines_open(&lr, fp) != 0) return 1;
+	while ((ret = lines_next(&lr, &line, &len)) > 0) {
+		int64_t pos;
+
+		if (len > 0 && line[len - 1] == '\r') len--;
+		if (len == 0) continue;
+		pos = mphf_lookup(&table, line, len);
+		if (pos < 0) fputs("- ", stdout);
+		else printf("%" PRId64 " ", pos);
+		fwrite(line, 1, len, stdout);
+		fputc('\n', stdout);
+	}
+	lines_close(&lr);
+	return (ret < 0) ? 1 : 0;
+}
+
+
+/* Print one --client result the way a local run would */
+static void client_result(int index, jodyhash_t hash, const char *err)
+{
+	const char *name = client_names[index];
+
+	if (err != NULL) {
+		fprintf(stderr, "error: %s: %s\n", err, name);
+		error = EXIT_FAILURE;
+		return;
+	}
+	PRINTHASH(hash);
+	if (namemode == NAME_BINARY) printf(" *%s\n", name);
+	else if (namemode == NAME_PLAIN) printf(" %s\n", name);
+	else printf("\n");
+	return;
+}
+
+
+/* Load a manifest, or scan a directory reusing hashes from cache */
+static int tree_get(struct dirtree *t, const char *path, const struct dirtree *cache,
+		jodyhash_t *buf, size_t bufsize)
+{
+	struct stat st;
+	FILE *fp;
+	int ret;
+
+	dirtree_init(t);
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "error: cannot open: %s\n", path);
+		return 2;
+	}
+	if (S_ISDIR(st.st_mode)) return dirtree_scan(t, path, cache, buf, bufsize);
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "error: cannot open: %s\n", path);
+		return 2;
+	}
+	ret = dirtree_load(t, fp);
+	fclose(fp);
+	if (ret == 2) fprintf(stderr, "error: damaged tree manifest, or not for %d bit hashes: %s\n", JODY_HASH_WIDTH, path);
+	else if (ret != 0) fprintf(stderr, "error reading manifest: %s\n", path);
+	return (ret != 0) ? 2 : 0;
+}
+
+
+static int is_dir(const char *path)
+{
+	struct stat st;
+
+	return (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+
+/* --tree and --tree-compare; returns the exit status */
+static int tree_run(char **args, jodyhash_t *buf, size_t bufsize)
+{
+	struct dirtree cache, a, b;
+	const struct dirtree *use_cache = NULL;
+	int ret, status = EXIT_SUCCESS;
+
+	dirtree_init(&a);
+	dirtree_init(&b);
+	if (tree_cache != NULL) {
+		if (tree_get(&cache, tree_cache, NULL, buf, bufsize) != 0) {
+			dirtree_free(&cache);
+			return 2;
+		}
+		use_cache = &cache;
+	}
+
+	if (treemode == TREE_SCAN) {
+		ret = tree_get(&a, args[0], use_cache, buf, bufsize);
+		if (ret == 0 || ret == 1) {
+			if (dirtree_save(&a, stdout) != 0) ret = 2;
+			if (statsmode == 1) fprintf(stderr, "files hashed: %" PRIu64 ", reused: %" PRIu64 "\n", a.hashed, a.cached);
+		}
+		dirtree_free(&a);
+		status = (ret != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+		goto done;
+	}
+
+	/* A manifest on one side doubles as the stat cache for the other */
+	if (!is_dir(args[0])) {
+		ret = tree_get(&a, args[0], NULL, buf, bufsize);
+		if (ret != 2) ret |= tree_get(&b, args[1], (use_cache != NULL) ? use_cache : &a, buf, bufsize);
+	} else {
+		if (!is_dir(args[1])) {
+			ret = tree_get(&b, args[1], NULL, buf, bufsize);
+			if (ret != 2) ret |= tree_get(&a, args[0], (use_cache != NULL) ? use_cache : &b, buf, bufsize);
+		} else {
+			ret = tree_get(&a, args[0], use_cache, buf, bufsize);
+			if (ret != 2) ret |= tree_get(&b, args[1], use_cache, buf, bufsize);
+		}
+	}
+	if (ret < 2 && a.root != NULL && b.root != NULL) {
+		if (dirtree_compare(&a, &b, stdout) != 0) status = 1;
+	}
+	if (ret != 0) status = 2;
+	dirtree_free(&a);
+	dirtree_free(&b);
+
+done:
+	if (use_cache != NULL) dirtree_free(&cache);
+	return status;
+}
+
+
 #ifdef UNICODE
 /* Copy Windows wide character arguments to UTF-8 */
 static void widearg_to_argv(int argc, wchar_t **wargv, char **argv)
@@ -131,31 +620,8 @@ int main(int argc, char **argv)
 	static FILE *fp;
 	static jodyhash_t hash;
 	static int argnum = 1;
-	static int outmode = 0;
+	static int opt;
 	static int read_err = 0;
-	//intmax_t bytes = 0;
-
-#ifdef USE_PERF_CODE
-	struct perf_event_attr pe;
-	long long pcnt;
-	int fd;
-	/* From man perf_event_open(2) */
-	memset(&pe, 0, sizeof(struct perf_event_attr));
-	pe.type = PERF_TYPE_HARDWARE;
-	pe.size = sizeof(struct perf_event_attr);
-	pe.config = PERF_COUNT_HW_CPU_CYCLES;
-	pe.disabled = 1;
-	pe.exclude_kernel = 1;
-	// Don't count hypervisor events.
-	pe.exclude_hv = 1;
-	errno = 0;
-	fd = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
-	if (fd == -1) {
-		fprintf(stderr, "Error opening perf %llx: %s\n", pe.config, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
-	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-#endif /* USE_PERF_CODE */
 
 #ifdef UNICODE
 	static wchar_t wname[PATH_MAX];
@@ -168,31 +634,312 @@ int main(int argc, char **argv)
 
 	progname = argv[0];
 
-	/* Process options */
-	if (argc > 1) {
-		if (!strcmp("-v", argv[1])) {
-			usage(0);
-			exit(EXIT_SUCCESS);
+	/* Process options; '+' stops at the first file name so argv and
+	 * wargv indexes stay in sync */
+	while ((opt = getopt_long(argc, argv, "+bsnlLBrtudM:hv", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'b':
+			case 's': namemode = NAME_BINARY; break;
+			case 'n': namemode = NAME_PLAIN; break;
+			case 'l': linemode = 1; break;
+			case 'L': linemode = 2; break;
+			case 'B': if (add_output(OUT_BLOCK, 0, NULL) != 0) exit(EXIT_FAILURE); break;
+			case 'r': if (add_output(OUT_ROLL, 0, NULL) != 0) exit(EXIT_FAILURE); break;
+			case 'M': if (parse_outputs(optarg) != 0) exit(EXIT_FAILURE); break;
+			case 't': tarmode = 1; break;
+			case 'u': uniqmode = 1; break;
+			case 'd': distinct = 1; break;
+			case OPT_PRECISION:
+				precision = atoi(optarg);
+				if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+					fprintf(stderr, "error: precision must be %d to %d\n", HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_SKETCH_SAVE: sketch_save = optarg; distinct = 1; break;
+			case OPT_INDEX_BUILD: index_build = optarg; break;
+			case OPT_INDEX_MATCH: index_match = optarg; break;
+			case OPT_TREE: treemode = TREE_SCAN; break;
+			case OPT_TREE_COMPARE: treemode = TREE_COMPARE; break;
+			case OPT_TREE_CACHE: tree_cache = optarg; break;
+			case OPT_MPHF_BUILD: mphf_build_path = optarg; break;
+			case OPT_MPHF_QUERY: mphf_query_path = optarg; break;
+			case OPT_DAEMON: daemon_socket = optarg; break;
+			case OPT_CLIENT: client_socket = optarg; break;
+			case OPT_WATCH: watchmode = 1; break;
+			case OPT_PARTITION_OUT: partition_out = optarg; break;
+			case OPT_PARTITION:
+				partitions = atoi(optarg);
+				if (partitions < 1 || partitions > PARTITION_MAX) {
+					fprintf(stderr, "error: partitions must be 1 to %d\n", PARTITION_MAX);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_RECORD:
+				record = atol(optarg);
+				if (record < 1 || record > 16 * 1024 * 1024) {
+					fprintf(stderr, "error: record size must be 1 to 16777216 bytes\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_WATCH_MANIFEST: watch_manifest = optarg; break;
+			case OPT_DEBOUNCE:
+				debounce = atoi(optarg);
+				if (debounce < 1 || debounce > 60000) {
+					fprintf(stderr, "error: debounce must be 1 to 60000 ms\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_WORKERS:
+				workers = atoi(optarg);
+				if (workers < 1 || workers > 1024) {
+					fprintf(stderr, "error: workers must be 1 to 1024\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_MPHF_SEED:
+				if (parse_size(optarg, &mphf_seed) != 0) {
+					fprintf(stderr, "error: bad seed: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_STATS:
+				if (optarg == NULL) statsmode = 1;
+				else if (!strcmp(optarg, "json")) statsmode = 2;
+				else {
+					fprintf(stderr, "error: unknown stats format: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_SKETCH_LOAD:
+				if (num_sketches >= MAX_SKETCHES) {
+					fprintf(stderr, "error: too many sketches (max %d)\n", MAX_SKETCHES);
+					exit(EXIT_FAILURE);
+				}
+				sketch_load[num_sketches++] = optarg;
+				distinct = 1;
+				break;
+			case 'v':
+				usage(0);
+				exit(EXIT_SUCCESS);
+			case 'h':
+				usage(1);
+				exit(EXIT_SUCCESS);
+			default:
+				usage(1);
+				exit(EXIT_FAILURE);
+		}
+	}
+	argnum = optind;
+
+	/* Modes that take over the whole run can't be combined */
+	{
+		const struct { int on; const char *name; } modes[] = {
+			{ index_build != NULL, "--index-build" },
+			{ index_match != NULL, "--index-match" },
+			{ treemode != 0, "--tree/--tree-compare" },
+			{ mphf_build_path != NULL, "--mphf-build" },
+			{ mphf_query_path != NULL, "--mphf-query" },
+			{ daemon_socket != NULL, "--daemon" },
+			{ client_socket != NULL, "--client" },
+			{ watchmode != 0, "--watch" },
+			{ partitions != 0, "--partition" }
+		};
+		const char *active = NULL;
+
+		for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			if (!modes[m].on) continue;
+			if (active != NULL) {
+				fprintf(stderr, "error: %s cannot be combined with %s\n", active, modes[m].name);
+				exit(EXIT_FAILURE);
+			}
+			active = modes[m].name;
+		}
+	}
+	if (linemode != 0 && num_outputs > 0) {
+		fprintf(stderr, "error: -l/-L cannot be combined with -B, -r, or -M\n");
+		exit(EXIT_FAILURE);
+	}
+	if (tarmode != 0 && (linemode != 0 || num_outputs > 0)) {
+		fprintf(stderr, "error: -t cannot be combined with -l, -L, -B, -r, or -M\n");
+		exit(EXIT_FAILURE);
+	}
+	if (uniqmode != 0) {
+		if (tarmode != 0 || linemode != 0 || num_outputs > 0) {
+			fprintf(stderr, "error: -u cannot be combined with other hashing modes\n");
+			exit(EXIT_FAILURE);
+		}
+		if (uniq_init() != 0) goto error_oom;
+	}
+	if (partitions != 0) {
+		if (tarmode != 0 || linemode != 0 || uniqmode != 0 || num_outputs > 0 || distinct != 0) {
+			fprintf(stderr, "error: --partition cannot be combined with other hashing modes\n");
+			exit(EXIT_FAILURE);
+		}
+		if (partition_out == NULL) {
+			fprintf(stderr, "error: --partition needs --partition-out\n");
+			exit(EXIT_FAILURE);
+		}
+		switch (partition_init(partitions, partition_out, (size_t)record)) {
+			case 0: break;
+			case 2: goto error_oom;
+			default: exit(EXIT_FAILURE);
+		}
+	} else if (partition_out != NULL || record != 0) {
+		fprintf(stderr, "error: --partition-out and --record need --partition\n");
+		exit(EXIT_FAILURE);
+	}
+	if (distinct != 0) {
+		if (tarmode != 0 || uniqmode != 0 || hf.want & (HF_ROLL | HF_PREFIX) || num_outputs > 1) {
+			fprintf(stderr, "error: -d only works with -l, -L, -B, or plain file hashing\n");
+			exit(EXIT_FAILURE);
+		}
+		if (hll_init(&sketch, precision) != 0) goto error_oom;
+		for (int sk = 0; sk < num_sketches; sk++) {
+			switch (hll_load(&sketch, sketch_load[sk])) {
+				case 0: break;
+				case 2:
+					fprintf(stderr, "error: bad or incompatible sketch (needs precision >= %d): %s\n",
+							precision, sketch_load[sk]);
+					exit(EXIT_FAILURE);
+				default:
+					fprintf(stderr, "error: cannot read sketch: %s\n", sketch_load[sk]);
+					exit(EXIT_FAILURE);
+			}
+		}
+		/* Merging saved sketches alone doesn't need input from stdin */
+		if (num_sketches > 0 && argnum >= argc) argnum = argc + 1;
+	}
+	if (index_build != NULL) {
+		FILE **inputs;
+		int ninputs = (argnum < argc) ? argc - argnum : 1;
+
+		inputs = (FILE **)malloc(sizeof(FILE *) * (size_t)ninputs);
+		if (inputs == NULL) goto error_oom;
+		if (argnum >= argc) inputs[0] = stdin;
+		for (int in = 0; argnum + in < argc; in++) {
+			if (!strcmp(argv[argnum + in], "-")) inputs[in] = stdin;
+			else if ((inputs[in] = fopen(argv[argnum + in], "rb")) == NULL) {
+				fprintf(stderr, "error: cannot open: %s\n", argv[argnum + in]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		exit(hashindex_build(index_build, inputs, ninputs) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (daemon_socket != NULL || client_socket != NULL) {
+		static char dash[] = "-";
+		static char *stdin_name[] = { dash };
+
+		if (linemode != 0 || tarmode != 0 || uniqmode != 0 || distinct != 0 || num_outputs > 0) {
+			fprintf(stderr, "error: --daemon and --client cannot be combined with other modes\n");
+			exit(EXIT_FAILURE);
+		}
+		if (daemon_socket != NULL) {
+			if (workers == 0) {
+				long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+				workers = (cpus > 0 && cpus <= 1024) ? (int)cpus : 4;
+			}
+			exit(daemon_run(daemon_socket, workers) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		if (argnum < argc) client_names = argv + argnum;
+		else client_names = stdin_name;
+		if (client_run(client_socket, client_names, (argnum < argc) ? argc - argnum : 1, client_result) != 0)
+			error = EXIT_FAILURE;
+		exit(error);
+	}
+	if (mphf_build_path != NULL) {
+		FILE **inputs;
+		int ninputs = (argnum < argc) ? argc - argnum : 1;
+
+		inputs = (FILE **)malloc(sizeof(FILE *) * (size_t)ninputs);
+		if (inputs == NULL) goto error_oom;
+		if (argnum >= argc) inputs[0] = stdin;
+		for (int in = 0; argnum + in < argc; in++) {
+			if (!strcmp(argv[argnum + in], "-")) inputs[in] = stdin;
+			else if ((inputs[in] = fopen(argv[argnum + in], "rb")) == NULL) {
+				fprintf(stderr, "error: cannot open: %s\n", argv[argnum + in]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		exit(mphf_build(mphf_build_path, inputs, ninputs, mphf_seed) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (mphf_query_path != NULL) {
+		if (linemode != 0 || tarmode != 0 || uniqmode != 0 || distinct != 0 || num_outputs > 0) {
+			fprintf(stderr, "error: --mphf-query cannot be combined with other hashing modes\n");
+			exit(EXIT_FAILURE);
+		}
+		switch (mphf_open(&table, mphf_query_path)) {
+			case 0: break;
+			case 2:
+				fprintf(stderr, "error: damaged table, or not for %d bit hashes: %s\n", JODY_HASH_WIDTH, mphf_query_path);
+				exit(EXIT_FAILURE);
+			default:
+				fprintf(stderr, "error: cannot open table: %s\n", mphf_query_path);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (index_match != NULL) {
+		if (tarmode != 0 || uniqmode != 0 || distinct != 0 || num_outputs > 0) {
+			fprintf(stderr, "error: --index-match only works with -l, -L, or plain file hashing\n");
+			exit(EXIT_FAILURE);
+		}
+		switch (hashindex_open(&known, index_match)) {
+			case 0: break;
+			case 2:
+				fprintf(stderr, "error: not an index for %d bit hashes: %s\n", JODY_HASH_WIDTH, index_match);
+				exit(EXIT_FAILURE);
+			default:
+				fprintf(stderr, "error: cannot open index: %s\n", index_match);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (watchmode != 0) {
+		if (linemode != 0 || tarmode != 0 || uniqmode != 0 || distinct != 0 || num_outputs > 0
+				|| tree_cache != NULL) {
+			fprintf(stderr, "error: --watch cannot be combined with other modes\n");
+			exit(EXIT_FAILURE);
+		}
+		if (argc - argnum != 1) {
+			fprintf(stderr, "error: --watch needs one directory\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(watch_run(argv[argnum], watch_manifest, (unsigned int)debounce, blk, BSIZE) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (watch_manifest != NULL) {
+		fprintf(stderr, "error: --watch-manifest needs --watch\n");
+		exit(EXIT_FAILURE);
+	}
+	if (treemode != 0) {
+		if (linemode != 0 || tarmode != 0 || uniqmode != 0 || distinct != 0 || num_outputs > 0) {
+			fprintf(stderr, "error: --tree and --tree-compare cannot be combined with other modes\n");
+			exit(EXIT_FAILURE);
 		}
-		if (!strcmp("-h", argv[1]) || !strcmp("--help", argv[1])) {
-			usage(1);
-			exit(EXIT_SUCCESS);
+		if (argc - argnum != treemode) {
+			fprintf(stderr, "error: %s\n", (treemode == TREE_SCAN) ?
+					"--tree needs one directory" : "--tree-compare needs two directories or manifests");
+			exit(EXIT_FAILURE);
 		}
+		if (statsmode != 0) stats_init();
+		error = tree_run(argv + argnum, blk, BSIZE);
+		goto finish;
 	}
-	if (argc > 2) {
-		if (!strcmp("-s", argv[1]) || !strcmp("-b", argv[1])) outmode = 1;
-		if (!strcmp("-l", argv[1])) outmode = 2;
-		if (!strcmp("-L", argv[1])) outmode = 3;
-		if (!strcmp("-n", argv[1])) outmode = 4;
-		if (!strcmp("-B", argv[1])) outmode = 5;
-		if (!strcmp("-r", argv[1])) outmode = 6;
-		if (outmode > 0 || !strcmp("--", argv[1])) argnum++;
+	if (tree_cache != NULL) {
+		fprintf(stderr, "error: --tree-cache needs --tree or --tree-compare\n");
+		exit(EXIT_FAILURE);
 	}
+	if (num_outputs == 0) add_output(OUT_HASH, 0, NULL);
+	finish_outputs();
+	hf.block = print_block;
+
+	if (statsmode != 0) stats_init();
+	if (argnum > argc) goto finish;
 
 	do {
 		hash = 0;
+		hashfile_reset(&hf);
 		/* Read from stdin */
-		if (argc == 1 || !strcmp("-", argv[argnum])) {
+		if (argnum >= argc || !strcmp("-", argv[argnum])) {
 			strncpy(name, "-", PATH_MAX);
 #ifdef ON_WINDOWS
 			_setmode(_fileno(stdin), _O_BINARY);
@@ -215,15 +962,19 @@ int main(int argc, char **argv)
 			argnum++;
 			continue;
 		}
+		STATS_FILE();
 
 		/* Line-by-line hashing with -l/-L */
-		if (outmode == 2 || outmode == 3) {
-			while (fgets((char *)blk, BSIZE, fp) != NULL) {
+		if (linemode != 0) {
+			static struct linebuf lb;
+			ssize_t got;
+
+			lb.fd = fileno(fp);
+			lb.start = lb.end = 0;
+			lb.eof = 0;
+			/* Time between reads is charged to hashing */
+			while ((got = next_line(&lb, (char *)blk, BSIZE)) > 0) {
 				hash = 0;
-				if (ferror(fp)) {
-					fprintf(stderr, "error reading file: ");
-					goto error_loop1;
-				}
 				/* Skip empty lines */
 				i = strlen((char *)blk);
 				if (i < 2 || *(char *)blk == '\n') continue;
@@ -231,85 +982,96 @@ int main(int argc, char **argv)
 				if (((char *)blk)[i - 2] == '\r') ((char *)blk)[i - 2] = '\0';
 				else ((char *)blk)[i - 1] = '\0';
 
+				STATS_BYTES(i);
 				if (jody_block_hash(blk, &hash, i - 1) != 0) {
 					fprintf(stderr, "error hashing file: ");
 					goto error_loop1;
 				}
 
-				PRINTHASH(hash);
-				if (outmode == 3) printf(" '%s'\n", (char *)blk);
-				else printf("\n");
+				if (distinct != 0) hll_add(&sketch, hash);
+				else {
+					if (index_match != NULL) printf(hashindex_lookup(&known, hash) ? "hit " : "miss ");
+					PRINTHASH(hash);
+					if (linemode == 2) printf(" '%s'\n", (char *)blk);
+					else printf("\n");
+				}
 
-				if (feof(fp)) break;
 				continue;
 error_loop1:
 				ERR(wname, name);
 				error = EXIT_FAILURE; read_err = 1;
 				break;
 			}
+			STATS_PHASE(STATS_OTHER);
+			if (got < 0) {
+				fprintf(stderr, "error reading file: ");
+				ERR(wname, name);
+				error = EXIT_FAILURE; read_err = 1;
+			}
 			goto close_file;
 		}
 
-		while ((i = fread((void *)blk, 1, BSIZE, fp))) {
-			if (ferror(fp)) {
+		/* Minimal perfect hash table lookups with --mphf-query */
+		if (mphf_query_path != NULL) {
+			if (mphf_query_stream(fp) != 0) {
+				fprintf(stderr, "error reading file: ");
 				ERR(wname, name);
-				error = EXIT_FAILURE; read_err = 1;
-				break;
+				error = EXIT_FAILURE;
 			}
-			//bytes += i;
-			if (outmode == 5) {
-				/* Hash sub-blocks in the file */
-				const int kbsize = 4096;
-				const int kboffsize = kbsize / (int)sizeof(jodyhash_t);
-				int kblk = 0;
-				size_t kbdrop;
-
-				while (i > 0) {
-					hash = 0;
-					kbdrop = (i > kbsize) ? kbsize : i;
-					if (jody_block_hash(blk + (kblk * kboffsize), &hash, kbdrop) != 0) goto error_loop2;
-					PRINTHASH(hash); printf("\n");
-					kblk++;
-					i -= kbdrop;
-					continue;
-error_loop2:
-					fprintf(stderr, "error hashing file: ");
-					ERR(wname, name);
-					error = EXIT_FAILURE; read_err = 1;
-					break;
-				}
-			} else {
-#ifdef USE_PERF_CODE
-				/* perf benchmarked code */
-				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
-				if ((outmode == 6 ? jody_rolling_block_hash(blk, &hash, i)
-						: jody_block_hash(blk, &hash, i)) != 0) {
-					fprintf(stderr, "error hashing file: ");
+			goto close_file;
+		}
+
+		/* Distinct lines with -u */
+		if (uniqmode != 0) {
+			switch (uniq_stream(fp)) {
+				case 0: break;
+				case 2: goto error_oom;
+				default:
+					fprintf(stderr, "error reading file: ");
 					ERR(wname, name);
-					error = EXIT_FAILURE; read_err = 1;
+					error = EXIT_FAILURE;
 					break;
-				}
-				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
-#else
-				/* non-benchmarked code */
-				fprintf(stderr, "doing a rolling hash of %lu bytes\n", i);
-				if ((outmode == 6 ? jody_rolling_block_hash(blk, &hash, i)
-						: jody_block_hash(blk, &hash, i)) != 0) {
-					fprintf(stderr, "error hashing file: ");
+			}
+			goto close_file;
+		}
+
+		/* Hash partitioning with --partition */
+		if (partitions != 0) {
+			switch (partition_stream(fp)) {
+				case 0: break;
+				case 2: goto error_oom;
+				case 3: exit(EXIT_FAILURE);
+				default:
+					fprintf(stderr, "error reading file: ");
 					ERR(wname, name);
-					error = EXIT_FAILURE; read_err = 1;
+					error = EXIT_FAILURE;
 					break;
-				}
-#endif /* USE_PERF_CODE */
 			}
-			if (feof(fp)) break;
+			goto close_file;
 		}
 
-#ifdef USE_PERF_CODE
-		read(fd, &pcnt, sizeof(long long));
-		fprintf(stderr, "CPU cycles: %lld\n", pcnt);
-		close(fd);
-#endif /* USE_PERF_CODE */
+		/* Per-member hashes of a tar archive with -t */
+		if (tarmode != 0) {
+			if (tar_hash_stream(fp, blk, BSIZE) != 0) {
+				fprintf(stderr, "error in tar archive: ");
+				ERR(wname, name);
+				error = EXIT_FAILURE;
+			}
+			goto close_file;
+		}
+
+		switch (hashfile_read(&hf, fp, blk, BSIZE)) {
+			case HF_OK: break;
+			case HF_ERR_HASH:
+				fprintf(stderr, "error hashing file: ");
+				/* Fall through */
+			case HF_ERR_READ:
+			default:
+				ERR(wname, name);
+				error = EXIT_FAILURE; read_err = 1;
+				break;
+		}
+		STATS_BYTES(hf.bytes);
 
 		/* Loop without result on read errors */
 		if (read_err == 1) {
@@ -317,34 +1079,74 @@ error_loop2:
 			goto close_file;
 		}
 
-		if (outmode != 5) PRINTHASH(hash);
+		for (int o = 0; o < num_outputs; o++) {
+			FILE *out = outputs[o].fp;
+
+			switch (outputs[o].kind) {
+				case OUT_HASH:
+					hash = hf.hash;
+					if (distinct != 0) {
+						hll_add(&sketch, hash);
+						continue;
+					}
+					break;
+				case OUT_ROLL: hash = hf.roll; break;
+				case OUT_PREFIX: hash = hf.prefix[outputs[o].prefix]; break;
+				case OUT_BLOCK:
+				default:
+					/* Unlabeled block lists end with an empty line */
+					if (outputs[o].tag[0] == '\0' && distinct == 0) fputc('\n', out);
+					continue;
+			}
+			if (outputs[o].tag[0] != '\0') fprintf(out, "%s ", outputs[o].tag);
+			if (index_match != NULL) fprintf(out, hashindex_lookup(&known, hash) ? "hit " : "miss ");
+			FPRINTHASH(out, hash);
 
 #ifdef UNICODE
-		_setmode(_fileno(stdout), _O_U16TEXT);
-		if (outmode == 1) wprintf(L" *%S", wargv[argnum]);
-		else if (outmode == 4) wprintf(L" %S", wargv[argnum]);
-		_setmode(_fileno(stdout), _O_TEXT);
-		printf("\n");
-#else
-		if (outmode == 1) printf(" *%s\n", name);
-		else if (outmode == 4) printf(" %s\n", name);
-		else printf("\n");
+			if (out == stdout) {
+				_setmode(_fileno(stdout), _O_U16TEXT);
+				if (namemode == NAME_BINARY) wprintf(L" *%S", wargv[argnum]);
+				else if (namemode == NAME_PLAIN) wprintf(L" %S", wargv[argnum]);
+				_setmode(_fileno(stdout), _O_TEXT);
+				printf("\n");
+				continue;
+			}
 #endif /* UNICODE */
-		//fprintf(stderr, "processed %jd bytes\n", bytes);
+			if (namemode == NAME_BINARY) fprintf(out, " *%s\n", name);
+			else if (namemode == NAME_PLAIN) fprintf(out, " %s\n", name);
+			else fputc('\n', out);
+		}
 close_file:
 		fclose(fp);
 		argnum++;
 	} while (argnum < argc);
 
+finish:
+	if (distinct != 0) {
+		printf("%.0f\n", hll_estimate(&sketch));
+		if (sketch_save != NULL && hll_save(&sketch, sketch_save) != 0) {
+			fprintf(stderr, "error: cannot write sketch: %s\n", sketch_save);
+			error = EXIT_FAILURE;
+		}
+		hll_free(&sketch);
+	}
+	if (statsmode != 0) stats_report(stderr, statsmode == 2);
+	if (index_match != NULL) hashindex_close(&known);
+	for (int o = 0; o < num_outputs; o++)
+		if (outputs[o].fp != stdout && fclose(outputs[o].fp) != 0) error = EXIT_FAILURE;
+
+	if (uniqmode != 0) uniq_done();
+	if (partitions != 0 && partition_done() != 0) error = EXIT_FAILURE;
+	if (mphf_query_path != NULL) mphf_close(&table);
+
 	exit(error);
 
-#ifdef UNICODE
 error_oom:
 	fprintf(stderr, "out of memory\n");
 	exit(EXIT_FAILURE);
+#ifdef UNICODE
 error_mb2wc:
 	fprintf(stderr, "fatal: MultiByteToWideChar failed\n");
 	exit(EXIT_FAILURE);
 #endif
 }
-
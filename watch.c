@@ -0,0 +1,345 @@
+/* jodyhash utility: keep a directory tree's hashes current with inotify
+ *
+ * The tree is scanned once (reusing a previous manifest as a stat cache
+ * when there is one), then every directory is watched. Events only mark
+ * directories and written files dirty; once events have been quiet for
+ * the debounce interval (or have kept coming for ten of them) each dirty
+ * directory is refreshed on its own, files that were closed after
+ * writing are re-hashed, and the Merkle hashes above them are updated.
+ * Work is proportional to what changed, not to the size of the tree.
+ *
+ * Changes are streamed to stdout as "+ HASH path", "M HASH path" and
+ * "- path" (directories end in '/'), and the manifest file, if given,
+ * is rewritten after every batch by writing a new file and renaming it.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under the MIT License (see LICENSE for details)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "jody_hash.h"
+#include "watch.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include "hashset.h"
+#include "dirtree.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+/* Longest wait for a quiet moment, in debounce intervals */
+#define WATCH_MAX_DELAY 10
+
+struct watch {
+	int fd;
+	struct dirtree tree;
+	/* Relative directory path for each watch descriptor */
+	char **wdpath;
+	int wdalloc;
+	struct hashset dirty;   /* Directories to refresh */
+	struct hashset written; /* Files closed after writing */
+	int oom;
+};
+
+static volatile sig_atomic_t got_signal = 0;
+
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	got_signal = 1;
+	return;
+}
+
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+
+/* Called by the tree scan before reading each directory, so nothing
+ * created while it is being read can be missed */
+static void add_watch(const char *path, void *arg)
+{
+	struct watch *w = (struct watch *)arg;
+	const char *rel = path + strlen(w->tree.path);
+	int wd;
+
+	if (*rel == '/') rel++;
+	wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+	if (wd < 0) {
+		fprintf(stderr, "error: cannot watch %s: %s\n", path,
+				(errno == ENOSPC) ? "watch limit reached (fs.inotify.max_user_watches)" : strerror(errno));
+		return;
+	}
+	if (wd >= w->wdalloc) {
+		int newalloc = w->wdalloc ? w->wdalloc : 1024;
+		char **newpath;
+
+		while (wd >= newalloc) newalloc *= 2;
+		newpath = (char **)realloc(w->wdpath, (size_t)newalloc * sizeof(char *));
+		if (newpath == NULL) {
+			w->oom = 1;
+			return;
+		}
+		memset(newpath + w->wdalloc, 0, (size_t)(newalloc - w->wdalloc) * sizeof(char *));
+		w->wdpath = newpath;
+		w->wdalloc = newalloc;
+	}
+	/* A renamed directory keeps its watch under the new name */
+	free(w->wdpath[wd]);
+	w->wdpath[wd] = strdup(rel);
+	if (w->wdpath[wd] == NULL) w->oom = 1;
+	return;
+}
+
+
+static int mark(struct hashset *set, const char *path)
+{
+	int inserted;
+
+	return (hashset_insert(set, path, strlen(path), &inserted) == NULL) ? 1 : 0;
+}
+
+
+static int handle_event(struct watch *w, const struct inotify_event *ev)
+{
+	char path[PATH_MAX];
+	const char *dir;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/* Events were lost: look at every directory again */
+		for (int wd = 0; wd < w->wdalloc; wd++)
+			if (w->wdpath[wd] != NULL && mark(&w->dirty, w->wdpath[wd]) != 0) return 1;
+		return 0;
+	}
+	if (ev->wd < 0 || ev->wd >= w->wdalloc || w->wdpath[ev->wd] == NULL) return 0;
+	dir = w->wdpath[ev->wd];
+	if (ev->mask & IN_IGNORED) {
+		free(w->wdpath[ev->wd]);
+		w->wdpath[ev->wd] = NULL;
+		return 0;
+	}
+	if (mark(&w->dirty, dir) != 0) return 1;
+	if ((ev->mask & IN_CLOSE_WRITE) && ev->len > 0) {
+		if (*dir != '\0') snprintf(path, sizeof(path), "%s/%s", dir, ev->name);
+		else snprintf(path, sizeof(path), "%s", ev->name);
+		if (mark(&w->written, path) != 0) return 1;
+	}
+	return 0;
+}
+
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+/* Refresh every dirty directory, parents before children */
+static int process(struct watch *w, jodyhash_t *buf, size_t bufsize)
+{
+	const char **dirs;
+	const char *key;
+	size_t n = 0, iter = 0, len;
+	int ret = 0;
+
+	dirs = (const char **)malloc((w->dirty.count + 1) * sizeof(char *));
+	if (dirs == NULL) return 2;
+	/* Keys are not NUL-terminated; copy them */
+	while (hashset_next(&w->dirty, &iter, &key, &len) != NULL) {
+		char *copy = (char *)malloc(len + 1);
+
+		if (copy == NULL) {
+			ret = 2;
+			break;
+		}
+		memcpy(copy, key, len);
+		copy[len] = '\0';
+		dirs[n++] = copy;
+	}
+	if (ret == 0) {
+		qsort(dirs, n, sizeof(char *), cmp_str);
+		for (size_t i = 0; i < n; i++) {
+			int r = dirtree_refresh(&w->tree, dirs[i], &w->written, buf, bufsize, stdout);
+
+			if (r > ret) ret = r;
+			if (r == 2) break;
+		}
+	}
+	for (size_t i = 0; i < n; i++) free((void *)(uintptr_t)dirs[i]);
+	free(dirs);
+
+	hashset_free(&w->dirty);
+	hashset_free(&w->written);
+	if (hashset_init(&w->dirty, 0) != 0 || hashset_init(&w->written, 0) != 0) return 2;
+	if (dirtree_compact(&w->tree) != 0) return 2;
+	return ret;
+}
+
+
+/* Write the manifest to a temporary file and rename it into place */
+static int save_manifest(const struct watch *w, const char *manifest)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", manifest) >= (int)sizeof(tmp)) return 1;
+	fp = fopen(tmp, "w");
+	if (fp == NULL) return 1;
+	if (dirtree_save(&w->tree, fp) != 0) {
+		fclose(fp);
+		unlink(tmp);
+		return 1;
+	}
+	if (fclose(fp) != 0 || rename(tmp, manifest) != 0) {
+		unlink(tmp);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* Watch dir until SIGINT or SIGTERM */
+extern int watch_run(const char *dir, const char *manifest, unsigned int debounce,
+		jodyhash_t *buf, size_t bufsize)
+{
+	/* Room for a burst of events; aligned for struct inotify_event */
+	static uint64_t evbuf[(64 * 1024) / sizeof(uint64_t)];
+	struct dirtree cache;
+	struct sigaction sa;
+	struct watch w;
+	uint64_t first = 0, last = 0;
+	int ret = 1, have_cache = 0;
+
+	memset(&w, 0, sizeof(w));
+	dirtree_init(&w.tree);
+	w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w.fd < 0) {
+		fprintf(stderr, "error: inotify unavailable: %s\n", strerror(errno));
+		return 1;
+	}
+	if (hashset_init(&w.dirty, 0) != 0 || hashset_init(&w.written, 0) != 0) goto error_oom;
+
+	/* A previous manifest saves re-reading unchanged files at startup */
+	dirtree_init(&cache);
+	if (manifest != NULL) {
+		FILE *fp = fopen(manifest, "rb");
+
+		if (fp != NULL) {
+			have_cache = (dirtree_load(&cache, fp) == 0);
+			fclose(fp);
+		}
+	}
+	w.tree.on_dir = add_watch;
+	w.tree.on_dir_arg = &w;
+	ret = dirtree_scan(&w.tree, dir, have_cache ? &cache : NULL, buf, bufsize);
+	dirtree_free(&cache);
+	if (ret == 2) goto error;
+	if (w.oom) goto error_oom;
+	if (manifest != NULL && save_manifest(&w, manifest) != 0) {
+		fprintf(stderr, "error: cannot write manifest: %s\n", manifest);
+		goto error;
+	}
+	fprintf(stderr, "watching %s (%llu files hashed, %llu reused)\n", w.tree.path,
+			(unsigned long long)w.tree.hashed, (unsigned long long)w.tree.cached);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ret = 0;
+	while (!got_signal) {
+		struct pollfd pfd;
+		int timeout = -1;
+		ssize_t got;
+
+		if (w.dirty.count > 0) {
+			uint64_t now = now_ms(), due = last + debounce;
+
+			if (due > first + (uint64_t)debounce * WATCH_MAX_DELAY) due = first + (uint64_t)debounce * WATCH_MAX_DELAY;
+			if (now >= due) {
+				int r = process(&w, buf, bufsize);
+
+				if (r == 2 || w.oom) goto error_oom;
+				if (r != 0) ret = 1;
+				if (manifest != NULL && save_manifest(&w, manifest) != 0) {
+					fprintf(stderr, "error: cannot write manifest: %s\n", manifest);
+					ret = 1;
+				}
+				fflush(stdout);
+				/* The next batch starts with its first event */
+				first = last = 0;
+				continue;
+			}
+			timeout = (int)(due - now);
+		}
+
+		pfd.fd = w.fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout) <= 0) continue;
+		while ((got = read(w.fd, evbuf, sizeof(evbuf))) > 0) {
+			const char *p = (const char *)evbuf;
+
+			while (p < (const char *)evbuf + got) {
+				const struct inotify_event *ev = (const struct inotify_event *)(const void *)p;
+
+				if (handle_event(&w, ev) != 0) goto error_oom;
+				p += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+		if (w.dirty.count > 0) {
+			last = now_ms();
+			if (first == 0 || first > last) first = last;
+		}
+	}
+
+	/* Don't lose changes that were still being debounced */
+	if (w.dirty.count > 0 && process(&w, buf, bufsize) == 2) goto error_oom;
+	if (manifest != NULL && save_manifest(&w, manifest) != 0) {
+		fprintf(stderr, "error: cannot write manifest: %s\n", manifest);
+		ret = 1;
+	}
+	fflush(stdout);
+	goto cleanup;
+
+error_oom:
+	fprintf(stderr, "out of memory\n");
+error:
+	ret = 1;
+cleanup:
+	close(w.fd);
+	for (int wd = 0; wd < w.wdalloc; wd++) free(w.wdpath[wd]);
+	free(w.wdpath);
+	if (w.dirty.slots != NULL) hashset_free(&w.dirty);
+	if (w.written.slots != NULL) hashset_free(&w.written);
+	dirtree_free(&w.tree);
+	return ret;
+}
+
+#else /* !__linux__ */
+
+extern int watch_run(const char *dir, const char *manifest, unsigned int debounce,
+		jodyhash_t *buf, size_t bufsize)
+{
+	(void)dir; (void)manifest; (void)debounce; (void)buf; (void)bufsize;
+	fprintf(stderr, "error: watch mode needs inotify (Linux)\n");
+	return 1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,21 @@
+/* jodyhash utility: keep a directory tree's hashes current (headers)
+ * See utility.c for license information */
+
+#ifndef JH_WATCH_H
+#define JH_WATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "jody_hash.h"
+
+extern int watch_run(const char *dir, const char *manifest, unsigned int debounce,
+		jodyhash_t *buf, size_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JH_WATCH_H */